@@ -20,22 +20,220 @@
  */
 
 #include "stdafx.h"
+#include <chrono>
 #include <mpc_defines.h>
 #include "DSUtil/Utils.h"
+#include "DSUtil/CPUInfo.h"
 #include "MemSubPic.h"
 
+#include <immintrin.h>
+
+//
+// RGB32 alpha blending
+//
+// All kernels give the same result as the original scalar code, including its
+// platform specific rounding, and leave the pixels with alpha 0xff untouched.
+//
+
+static inline uint32_t AlphaBlend_RGB32(const uint32_t d, const uint32_t s)
+{
+	const uint32_t a = s >> 24;
+#ifdef _WIN64
+	const uint32_t ia = 256 - a;
+	return ((((d&0x00ff00ff)*a)>>8) + (((s&0x00ff00ff)*ia)>>8)&0x00ff00ff)
+		| ((((d&0x0000ff00)*a)>>8) + (((s&0x0000ff00)*ia)>>8)&0x0000ff00);
+#else
+	return ((((d&0x00ff00ff)*a)>>8) + (s&0x00ff00ff)&0x00ff00ff)
+		| ((((d&0x0000ff00)*a)>>8) + (s&0x0000ff00)&0x0000ff00);
+#endif
+}
+
+static void AlphaBlt_RGB32_C(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+{
+	for (int j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+		const uint32_t* s2 = (const uint32_t*)s;
+		uint32_t* d2 = (uint32_t*)d;
+
+		for (int i = 0; i < w; i++) {
+			if (s2[i] < 0xff000000) {
+				d2[i] = AlphaBlend_RGB32(d2[i], s2[i]);
+			}
+		}
+	}
+}
+
+// The channels are multiplied with 16-bit multiplications: with a zero high half
+// the 32-bit lane gets the exact product of the scalar code.
+
+static inline __m128i AlphaBlend_RGB32_SSE2(const __m128i d, const __m128i s)
+{
+	const __m128i mask_rb = _mm_set1_epi32(0x00ff00ff);
+	const __m128i mask_g  = _mm_set1_epi32(0x0000ff00);
+	const __m128i mask_ff = _mm_set1_epi32(0x000000ff);
+
+	const __m128i a  = _mm_srli_epi32(s, 24);
+	const __m128i a2 = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+
+	__m128i rb = _mm_srli_epi32(_mm_mullo_epi16(_mm_and_si128(d, mask_rb), a2), 8);
+	__m128i g  = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(d, 8), mask_ff), a);
+#ifdef _WIN64
+	const __m128i ia  = _mm_sub_epi32(_mm_set1_epi32(256), a);
+	const __m128i ia2 = _mm_or_si128(ia, _mm_slli_epi32(ia, 16));
+	rb = _mm_add_epi32(rb, _mm_srli_epi32(_mm_mullo_epi16(_mm_and_si128(s, mask_rb), ia2), 8));
+	g  = _mm_add_epi32(g, _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(s, 8), mask_ff), ia));
+#else
+	rb = _mm_add_epi32(rb, _mm_and_si128(s, mask_rb));
+	g  = _mm_add_epi32(g, _mm_and_si128(s, mask_g));
+#endif
+	const __m128i r    = _mm_or_si128(_mm_and_si128(rb, mask_rb), _mm_and_si128(g, mask_g));
+	const __m128i keep = _mm_cmpeq_epi32(a, mask_ff);
+
+	return _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, r));
+}
+
+static inline bool IsTransparent_SSE2(const __m128i s)
+{
+	const __m128i mask_a = _mm_set1_epi32(0xff000000);
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(s, mask_a), mask_a)) == 0xffff;
+}
+
+static void AlphaBlt_RGB32_SSE2(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+{
+	for (int j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+		const uint32_t* s2 = (const uint32_t*)s;
+		uint32_t* d2 = (uint32_t*)d;
+
+		int i = 0;
+		while (i + 4 <= w) {
+			const __m128i ms = _mm_loadu_si128((const __m128i*)(s2 + i));
+
+			// skip the transparent runs 16 pixels at a time
+			if (i + 16 <= w) {
+				const __m128i ms_all = _mm_and_si128(
+					_mm_and_si128(ms, _mm_loadu_si128((const __m128i*)(s2 + i + 4))),
+					_mm_and_si128(_mm_loadu_si128((const __m128i*)(s2 + i + 8)), _mm_loadu_si128((const __m128i*)(s2 + i + 12))));
+				if (IsTransparent_SSE2(ms_all)) {
+					i += 16;
+					continue;
+				}
+			}
+
+			if (!IsTransparent_SSE2(ms)) {
+				const __m128i md = _mm_loadu_si128((const __m128i*)(d2 + i));
+				_mm_storeu_si128((__m128i*)(d2 + i), AlphaBlend_RGB32_SSE2(md, ms));
+			}
+			i += 4;
+		}
+
+		for (; i < w; i++) {
+			if (s2[i] < 0xff000000) {
+				d2[i] = AlphaBlend_RGB32(d2[i], s2[i]);
+			}
+		}
+	}
+}
+
+static inline __m256i AlphaBlend_RGB32_AVX2(const __m256i d, const __m256i s)
+{
+	const __m256i mask_rb = _mm256_set1_epi32(0x00ff00ff);
+	const __m256i mask_g  = _mm256_set1_epi32(0x0000ff00);
+	const __m256i mask_ff = _mm256_set1_epi32(0x000000ff);
+
+	const __m256i a  = _mm256_srli_epi32(s, 24);
+	const __m256i a2 = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+
+	__m256i rb = _mm256_srli_epi32(_mm256_mullo_epi16(_mm256_and_si256(d, mask_rb), a2), 8);
+	__m256i g  = _mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(d, 8), mask_ff), a);
+#ifdef _WIN64
+	const __m256i ia  = _mm256_sub_epi32(_mm256_set1_epi32(256), a);
+	const __m256i ia2 = _mm256_or_si256(ia, _mm256_slli_epi32(ia, 16));
+	rb = _mm256_add_epi32(rb, _mm256_srli_epi32(_mm256_mullo_epi16(_mm256_and_si256(s, mask_rb), ia2), 8));
+	g  = _mm256_add_epi32(g, _mm256_mullo_epi16(_mm256_and_si256(_mm256_srli_epi32(s, 8), mask_ff), ia));
+#else
+	rb = _mm256_add_epi32(rb, _mm256_and_si256(s, mask_rb));
+	g  = _mm256_add_epi32(g, _mm256_and_si256(s, mask_g));
+#endif
+	const __m256i r = _mm256_or_si256(_mm256_and_si256(rb, mask_rb), _mm256_and_si256(g, mask_g));
+
+	return _mm256_blendv_epi8(r, d, _mm256_cmpeq_epi32(a, mask_ff));
+}
+
+static inline bool IsTransparent_AVX2(const __m256i s)
+{
+	const __m256i mask_a = _mm256_set1_epi32(0xff000000);
+	return _mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(s, mask_a), mask_a)) == -1;
+}
+
+static void AlphaBlt_RGB32_AVX2(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
+{
+	for (int j = 0; j < h; j++, s += srcpitch, d += dstpitch) {
+		const uint32_t* s2 = (const uint32_t*)s;
+		uint32_t* d2 = (uint32_t*)d;
+
+		int i = 0;
+		while (i + 8 <= w) {
+			const __m256i ms = _mm256_loadu_si256((const __m256i*)(s2 + i));
+
+			// skip the transparent runs 32 pixels at a time
+			if (i + 32 <= w) {
+				const __m256i ms_all = _mm256_and_si256(
+					_mm256_and_si256(ms, _mm256_loadu_si256((const __m256i*)(s2 + i + 8))),
+					_mm256_and_si256(_mm256_loadu_si256((const __m256i*)(s2 + i + 16)), _mm256_loadu_si256((const __m256i*)(s2 + i + 24))));
+				if (IsTransparent_AVX2(ms_all)) {
+					i += 32;
+					continue;
+				}
+			}
+
+			if (!IsTransparent_AVX2(ms)) {
+				const __m256i md = _mm256_loadu_si256((const __m256i*)(d2 + i));
+				_mm256_storeu_si256((__m256i*)(d2 + i), AlphaBlend_RGB32_AVX2(md, ms));
+			}
+			i += 8;
+		}
+
+		for (; i < w; i++) {
+			if (s2[i] < 0xff000000) {
+				d2[i] = AlphaBlend_RGB32(d2[i], s2[i]);
+			}
+		}
+	}
+	_mm256_zeroupper();
+}
+
+typedef void (*AlphaBlt_RGB32_Fn)(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch);
+
+static AlphaBlt_RGB32_Fn GetAlphaBlt_RGB32()
+{
+	if (CPUInfo::HaveAVX2()) {
+		return AlphaBlt_RGB32_AVX2;
+	}
+	if (CPUInfo::GetFeatures() & CPUInfo::CPU_SSE2) {
+		return AlphaBlt_RGB32_SSE2;
+	}
+	return AlphaBlt_RGB32_C;
+}
+
 //
 // CMemSubPic
 //
 
-CMemSubPic::CMemSubPic(SubPicDesc& spd)
+CMemSubPic::CMemSubPic(SubPicDesc& spd, bool bSparse/* = false*/)
 	: m_spd(spd)
+	, m_bSparse(bSparse)
 {
 	ASSERT(m_spd.type == MSP_RGB32 && m_spd.bpp == 32);
 	ASSERT(!m_spd.pitchUV && !m_spd.bitsU && !m_spd.bitsV);
+	ASSERT(m_bSparse ? !m_spd.bits : !!m_spd.bits);
 
 	m_maxsize.SetSize(spd.w, spd.h);
 	m_rcDirty.SetRect(0, 0, spd.w, spd.h);
+
+	if (m_bSparse) {
+		m_nTilesX = (spd.w + TILE_SIZE - 1) / TILE_SIZE;
+		m_nTilesY = (spd.h + TILE_SIZE - 1) / TILE_SIZE;
+		m_tiles.resize(m_nTilesX * m_nTilesY);
+	}
 }
 
 CMemSubPic::~CMemSubPic()
@@ -43,6 +241,112 @@ CMemSubPic::~CMemSubPic()
 	SAFE_DELETE_ARRAY(m_spd.bits);
 }
 
+bool CMemSubPic::IsTransparent(const BYTE* p, int pitch, int w, int h) const
+{
+	// with inverted alpha the transparent pixels are fully zero, otherwise only the alpha matters
+	const uint32_t mask  = m_bInvAlpha ? 0xFFFFFFFF : 0xFF000000;
+	const uint32_t clear = GetClearColor();
+
+	for (int j = 0; j < h; j++, p += pitch) {
+		const uint32_t* p2 = (const uint32_t*)p;
+		uint32_t diff = 0;
+		for (int i = 0; i < w; i++) {
+			diff |= (p2[i] & mask) ^ clear;
+		}
+		if (diff) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Replaces the tiles with the visible parts of rc from the frame buffer src
+void CMemSubPic::StoreTiles(const SubPicDesc& src, const CRect& rc)
+{
+	ASSERT(m_bSparse);
+
+	for (auto& tile : m_tiles) {
+		tile.reset();
+	}
+
+	const uint32_t clear = GetClearColor();
+
+	ForEachTile(rc, [&](int index, const CRect& rcTile, const CRect& rcPart) {
+		const BYTE* s = src.bits + src.pitch * rcPart.top + rcPart.left * 4;
+		if (IsTransparent(s, src.pitch, rcPart.Width(), rcPart.Height())) {
+			return;
+		}
+
+		auto& tile = m_tiles[index];
+		tile.reset(new(std::nothrow) uint32_t[TILE_SIZE * TILE_SIZE]);
+		if (!tile) {
+			return;
+		}
+		if (rcPart != rcTile) {
+			fill_u32(tile.get(), clear, TILE_SIZE * TILE_SIZE);
+		}
+
+		uint32_t* d = tile.get() + (rcPart.top - rcTile.top) * TILE_SIZE + (rcPart.left - rcTile.left);
+		for (int j = 0; j < rcPart.Height(); j++, s += src.pitch, d += TILE_SIZE) {
+			memcpy(d, s, rcPart.Width() * 4);
+		}
+	});
+}
+
+// Writes the part rc of the tiles to the frame buffer dst, the missing tiles are cleared
+void CMemSubPic::LoadTiles(const SubPicDesc& dst, const CRect& rc) const
+{
+	ASSERT(m_bSparse);
+
+	const uint32_t clear = GetClearColor();
+
+	ForEachTile(rc, [&](int index, const CRect& rcTile, const CRect& rcPart) {
+		const auto& tile = m_tiles[index];
+		BYTE* d = dst.bits + dst.pitch * rcPart.top + rcPart.left * 4;
+
+		if (!tile) {
+			for (int j = 0; j < rcPart.Height(); j++, d += dst.pitch) {
+				fill_u32(d, clear, rcPart.Width());
+			}
+			return;
+		}
+
+		const uint32_t* s = tile.get() + (rcPart.top - rcTile.top) * TILE_SIZE + (rcPart.left - rcTile.left);
+		for (int j = 0; j < rcPart.Height(); j++, s += TILE_SIZE, d += dst.pitch) {
+			memcpy(d, s, rcPart.Width() * 4);
+		}
+	});
+}
+
+// Gives a sparse subpic a temporary frame buffer, only used if a sparse subpic is locked directly
+bool CMemSubPic::AllocBuffer()
+{
+	ASSERT(m_bSparse);
+
+	if (!m_spd.bits) {
+		m_spd.bits = new(std::nothrow) BYTE[m_spd.pitch * m_spd.h];
+		if (!m_spd.bits) {
+			return false;
+		}
+
+		LoadTiles(m_spd, CRect(0, 0, m_spd.w, m_spd.h));
+	}
+
+	return true;
+}
+
+// Moves the dirty rect of the temporary frame buffer to the tiles
+void CMemSubPic::ReleaseBuffer()
+{
+	ASSERT(m_bSparse);
+
+	if (m_spd.bits) {
+		StoreTiles(m_spd, m_rcDirty);
+		SAFE_DELETE_ARRAY(m_spd.bits);
+	}
+}
+
 // ISubPic
 
 STDMETHODIMP_(void*) CMemSubPic::GetObject()
@@ -79,6 +383,35 @@ STDMETHODIMP CMemSubPic::CopyTo(ISubPic* pSubPic)
 
 	ASSERT(dst.type == MSP_RGB32 && dst.bpp == 32);
 
+	auto pMemSubPic = dynamic_cast<CMemSubPic*>(pSubPic);
+	if (pMemSubPic && pMemSubPic->m_bSparse && !dst.bits) {
+		ASSERT(pMemSubPic->m_spd.w == m_spd.w && pMemSubPic->m_spd.h == m_spd.h);
+
+		if (src.bits) {
+			pMemSubPic->StoreTiles(src, m_rcDirty);
+		} else {
+			for (size_t i = 0; i < m_tiles.size(); i++) {
+				auto& tile = pMemSubPic->m_tiles[i];
+				tile.reset();
+				if (m_tiles[i]) {
+					tile.reset(new(std::nothrow) uint32_t[TILE_SIZE * TILE_SIZE]);
+					if (!tile) {
+						return E_OUTOFMEMORY;
+					}
+					memcpy(tile.get(), m_tiles[i].get(), TILE_SIZE * TILE_SIZE * 4);
+				}
+			}
+		}
+
+		return S_OK;
+	}
+
+	if (!src.bits) {
+		LoadTiles(dst, m_rcDirty);
+
+		return S_OK;
+	}
+
 	const UINT copyW_bytes = m_rcDirty.Width() * 4;
 	UINT copyH = m_rcDirty.Height();
 
@@ -100,13 +433,19 @@ STDMETHODIMP CMemSubPic::ClearDirtyRect()
 		return S_FALSE;
 	}
 
-	BYTE* ptr = m_spd.bits + m_spd.pitch * m_rcDirty.top + m_rcDirty.left * 4;
-	const UINT dirtyW = m_rcDirty.Width();
-	UINT dirtyH = m_rcDirty.Height();
-
-	while (dirtyH-- > 0) {
-		fill_u32(ptr, m_bInvAlpha ? 0x00000000 : 0xFF000000, dirtyW);
-		ptr += m_spd.pitch;
+	if (!m_spd.bits) {
+		for (auto& tile : m_tiles) {
+			tile.reset();
+		}
+	} else {
+		BYTE* ptr = m_spd.bits + m_spd.pitch * m_rcDirty.top + m_rcDirty.left * 4;
+		const UINT dirtyW = m_rcDirty.Width();
+		UINT dirtyH = m_rcDirty.Height();
+
+		while (dirtyH-- > 0) {
+			fill_u32(ptr, GetClearColor(), dirtyW);
+			ptr += m_spd.pitch;
+		}
 	}
 
 	m_rcDirty.SetRectEmpty();
@@ -116,6 +455,10 @@ STDMETHODIMP CMemSubPic::ClearDirtyRect()
 
 STDMETHODIMP CMemSubPic::Lock(SubPicDesc& spd)
 {
+	if (m_bSparse && !AllocBuffer()) {
+		return E_OUTOFMEMORY;
+	}
+
 	return GetDesc(spd);
 }
 
@@ -123,6 +466,10 @@ STDMETHODIMP CMemSubPic::Unlock(RECT* pDirtyRect)
 {
 	m_rcDirty = pDirtyRect ? *pDirtyRect : CRect(0, 0, m_spd.w, m_spd.h);
 
+	if (m_bSparse) {
+		ReleaseBuffer();
+	}
+
 	return S_OK;
 }
 
@@ -134,7 +481,49 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 		return E_POINTER;
 	}
 
-	const SubPicDesc& src = m_spd;
+	if (m_spd.bits) {
+		return AlphaBltDesc(m_spd, pSrc, pDst, pTarget);
+	}
+
+	// Sparse subpic, only the tiles with visible pixels are blended
+	const CRect rs(*pSrc), rd(*pDst);
+
+	if (rs.Width() != rd.Width() || rs.Height() != abs(rd.Height())) {
+		return E_INVALIDARG;
+	}
+
+	const CPoint offset = rd.TopLeft() - rs.TopLeft();
+	const bool bFlipped = rd.top > rd.bottom;
+
+	SubPicDesc tile;
+	tile.w     = TILE_SIZE;
+	tile.h     = TILE_SIZE;
+	tile.bpp   = 32;
+	tile.pitch = TILE_SIZE * 4;
+	tile.type  = m_spd.type;
+
+	HRESULT hr = S_OK;
+	ForEachTile(rs, [&](int index, const CRect& rcTile, const CRect& rcPart) {
+		if (FAILED(hr) || !m_tiles[index]) {
+			return;
+		}
+
+		tile.bits = (BYTE*)m_tiles[index].get();
+		CRect rcTileSrc = rcPart - rcTile.TopLeft();
+		CRect rcTileDst = rcPart + offset;
+		if (bFlipped) {
+			// bottom-up destination, the rows of the tile go up from rd.top
+			rcTileDst.top    = rd.top - (rcPart.top - rs.top);
+			rcTileDst.bottom = rd.top - (rcPart.bottom - rs.top);
+		}
+		hr = AlphaBltDesc(tile, rcTileSrc, rcTileDst, pTarget);
+	});
+
+	return hr;
+}
+
+HRESULT CMemSubPic::AlphaBltDesc(const SubPicDesc& src, RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
+{
 	SubPicDesc dst = *pTarget;
 
 	ASSERT(dst.type == MSP_RGB32 && dst.bpp == 32);
@@ -165,38 +554,60 @@ STDMETHODIMP CMemSubPic::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 		dst.pitch = -dst.pitch;
 	}
 
-	for (int j = 0; j < h; j++, s += src.pitch, d += dst.pitch) {
-		BYTE* s2 = s;
-		BYTE* s2end = s2 + w * 4;
+	static const AlphaBlt_RGB32_Fn fnAlphaBlt = GetAlphaBlt_RGB32();
+	fnAlphaBlt(w, h, d, dst.pitch, s, src.pitch);
 
-		uint32_t* d2 = (uint32_t*)d;
-		for (; s2 < s2end; s2 += 4, d2++) {
-#ifdef _WIN64
-			uint32_t ia = 256-s2[3];
-			if (s2[3] < 0xff) {
-				*d2 = ((((*d2&0x00ff00ff)*s2[3])>>8) + (((*((uint32_t*)s2)&0x00ff00ff)*ia)>>8)&0x00ff00ff)
-					| ((((*d2&0x0000ff00)*s2[3])>>8) + (((*((uint32_t*)s2)&0x0000ff00)*ia)>>8)&0x0000ff00);
-			}
-#else
-			if (s2[3] < 0xff) {
-				*d2 = ((((*d2&0x00ff00ff)*s2[3])>>8) + (*((uint32_t*)s2)&0x00ff00ff)&0x00ff00ff)
-					| ((((*d2&0x0000ff00)*s2[3])>>8) + (*((uint32_t*)s2)&0x0000ff00)&0x0000ff00);
-			}
-#endif
+	dst.pitch = abs(dst.pitch);
+
+	return S_OK;
+}
+
+double CMemSubPic::BenchmarkAlphaBlt(int kernel, CSize size, int nFrames)
+{
+	static const AlphaBlt_RGB32_Fn fns[BLEND_COUNT] = { AlphaBlt_RGB32_C, AlphaBlt_RGB32_SSE2, AlphaBlt_RGB32_AVX2 };
+
+	if (kernel < 0 || kernel >= BLEND_COUNT || size.cx <= 0 || size.cy <= 0 || nFrames <= 0
+			|| kernel == BLEND_SSE2 && !(CPUInfo::GetFeatures() & CPUInfo::CPU_SSE2)
+			|| kernel == BLEND_AVX2 && !CPUInfo::HaveAVX2()) {
+		return 0.0;
+	}
+
+	// transparent except for a band of "text" at the bottom with opaque, semi-transparent and clear pixels
+	std::vector<uint32_t> src((size_t)size.cx * size.cy);
+	for (int y = 0; y < size.cy; y++) {
+		for (int x = 0; x < size.cx; x++) {
+			const bool bText = y >= size.cy * 3 / 4 && y < size.cy * 15 / 16 && x >= size.cx / 8 && x < size.cx * 7 / 8;
+			const int k = (x * 7 + y * 13) % 8;
+			const uint32_t alpha = !bText || k < 3 ? 0xff : k < 6 ? 0x00 : 0x80;
+			src[(size_t)y * size.cx + x] = alpha << 24 | (k < 5 ? 0xffffff : 0x101010);
 		}
 	}
+	std::vector<uint32_t> dst((size_t)size.cx * size.cy, 0x00406080);
 
-	dst.pitch = abs(dst.pitch);
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < nFrames; i++) {
+		fns[kernel](size.cx, size.cy, (BYTE*)dst.data(), size.cx * 4, (const BYTE*)src.data(), size.cx * 4);
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-	return S_OK;
+	return seconds > 0.0 ? (double)size.cx * size.cy * nFrames / seconds / 1000000.0 : 0.0;
+}
+
+LPCWSTR CMemSubPic::GetAlphaBltName(int kernel)
+{
+	static const LPCWSTR names[BLEND_COUNT] = { L"C", L"SSE2", L"AVX2" };
+
+	return kernel >= 0 && kernel < BLEND_COUNT ? names[kernel] : L"";
 }
 
 //
 // CMemSubPicAllocator
 //
 
+// The dynamic subpics are sparse and locking one needs a full frame buffer,
+// so the queues render into the static subpic and copy the dirty rect into the tiles
 CMemSubPicAllocator::CMemSubPicAllocator(SIZE maxsize)
-	: CSubPicAllocatorImpl(maxsize, false)
+	: CSubPicAllocatorImpl(maxsize, true)
 	, m_maxsize(maxsize)
 {
 }
@@ -215,12 +626,16 @@ bool CMemSubPicAllocator::Alloc(bool fStatic, ISubPic** ppSubPic)
 	spd.bpp   = 32;
 	spd.pitch = spd.w * 4;
 	spd.type  = MSP_RGB32;
-	spd.bits  = new(std::nothrow) BYTE[spd.pitch * spd.h];
-	if (!spd.bits) {
-		return false;
+
+	// only the static subpic is rendered to directly, the queued dynamic ones are sparse
+	if (fStatic) {
+		spd.bits = new(std::nothrow) BYTE[spd.pitch * spd.h];
+		if (!spd.bits) {
+			return false;
+		}
 	}
 
-	*ppSubPic = DNew CMemSubPic(spd);
+	*ppSubPic = DNew CMemSubPic(spd, !fStatic);
 	if (!(*ppSubPic)) {
 		return false;
 	}
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <memory>
 #include "SubPicImpl.h"
 
 enum {
@@ -49,13 +50,47 @@ enum {
 // CMemSubPic
 
 // only RGB32 is supported
+// A sparse subpic has no frame buffer of its own, it keeps only the tiles that hold
+// visible pixels. A temporary frame buffer exists only between Lock and Unlock.
 class CMemSubPic : public CSubPicImpl
 {
 protected:
+	static constexpr int TILE_SIZE = 64;
+
 	SubPicDesc m_spd;
 
+	const bool m_bSparse;
+	int m_nTilesX = 0;
+	int m_nTilesY = 0;
+	std::vector<std::unique_ptr<uint32_t[]>> m_tiles; // nullptr for the transparent tiles
+
+	uint32_t GetClearColor() const { return m_bInvAlpha ? 0x00000000 : 0xFF000000; }
+	bool IsTransparent(const BYTE* p, int pitch, int w, int h) const;
+
+	// calls fn(tile index, tile rect, part of the tile inside rc) for each tile touching rc
+	template<typename F>
+	void ForEachTile(CRect rc, F&& fn) const {
+		rc &= CRect(0, 0, m_spd.w, m_spd.h);
+		if (rc.IsRectEmpty()) {
+			return;
+		}
+		for (int ty = rc.top / TILE_SIZE; ty * TILE_SIZE < rc.bottom; ty++) {
+			for (int tx = rc.left / TILE_SIZE; tx * TILE_SIZE < rc.right; tx++) {
+				const CRect rcTile(tx * TILE_SIZE, ty * TILE_SIZE, (tx + 1) * TILE_SIZE, (ty + 1) * TILE_SIZE);
+				fn(ty * m_nTilesX + tx, rcTile, rcTile & rc);
+			}
+		}
+	}
+
+	void StoreTiles(const SubPicDesc& src, const CRect& rc);
+	void LoadTiles(const SubPicDesc& dst, const CRect& rc) const;
+	bool AllocBuffer();
+	void ReleaseBuffer();
+
+	virtual HRESULT AlphaBltDesc(const SubPicDesc& src, RECT* pSrc, RECT* pDst, SubPicDesc* pTarget);
+
 public:
-	CMemSubPic(SubPicDesc& spd);
+	CMemSubPic(SubPicDesc& spd, bool bSparse = false);
 	virtual ~CMemSubPic();
 
 	// ISubPic
@@ -68,6 +103,17 @@ public:
 	STDMETHODIMP Lock(SubPicDesc& spd) override;
 	STDMETHODIMP Unlock(RECT* pDirtyRect) override;
 	STDMETHODIMP AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget) override;
+
+	enum {
+		BLEND_C,
+		BLEND_SSE2,
+		BLEND_AVX2,
+		BLEND_COUNT
+	};
+
+	// MPix/s of an RGB32 alpha blend kernel over a subtitle-like frame, 0 if the CPU lacks it
+	static double BenchmarkAlphaBlt(int kernel, CSize size, int nFrames);
+	static LPCWSTR GetAlphaBltName(int kernel);
 };
 
 // CMemSubPicAllocator
@@ -106,8 +106,8 @@ void ColorConvInit(const bool bt601)
 // CMemSubPicEx
 //
 
-CMemSubPicEx::CMemSubPicEx(SubPicDesc& spd, int alpha_blt_dst_type)
-	: CMemSubPic(spd)
+CMemSubPicEx::CMemSubPicEx(SubPicDesc& spd, int alpha_blt_dst_type, bool bSparse/* = false*/)
+	: CMemSubPic(spd, bSparse)
 	, m_alpha_blt_dst_type(alpha_blt_dst_type)
 {
 	switch (m_alpha_blt_dst_type) {
@@ -136,6 +136,9 @@ STDMETHODIMP CMemSubPicEx::Unlock(RECT* pDirtyRect)
 	m_rcDirty = pDirtyRect ? *pDirtyRect : CRect(0,0,m_spd.w,m_spd.h);
 
 	if (m_rcDirty.IsRectEmpty()) {
+		if (m_bSparse) {
+			ReleaseBuffer();
+		}
 		return S_OK;
 	}
 
@@ -156,10 +159,39 @@ STDMETHODIMP CMemSubPicEx::Unlock(RECT* pDirtyRect)
 		break;
 	}
 
-	const int w = m_rcDirty.Width();
-	const int h = m_rcDirty.Height();
-	BYTE* top = m_spd.bits + m_spd.pitch*m_rcDirty.top + m_rcDirty.left*4;
-	const BYTE* bottom = top + m_spd.pitch * h;
+	if (m_bSparse) {
+		ReleaseBuffer();
+	}
+
+	switch (m_alpha_blt_dst_type) {
+	case MSP_RGB32:
+	case MSP_RGB24:
+	case MSP_RGBA:
+		// blended as RGB
+		return S_OK;
+	}
+
+	// The fully transparent tiles are skipped, the blending never reads their colors
+	ForEachTile(m_rcDirty, [&](int index, const CRect& rcTile, const CRect& rcPart) {
+		if (m_bSparse) {
+			if (m_tiles[index]) {
+				BYTE* top = (BYTE*)(m_tiles[index].get() + (rcPart.top - rcTile.top) * TILE_SIZE + (rcPart.left - rcTile.left));
+				ConvertColor(top, TILE_SIZE * 4, rcPart.Width(), rcPart.Height());
+			}
+		} else {
+			BYTE* top = m_spd.bits + m_spd.pitch * rcPart.top + rcPart.left * 4;
+			if (!IsTransparent(top, m_spd.pitch, rcPart.Width(), rcPart.Height())) {
+				ConvertColor(top, m_spd.pitch, rcPart.Width(), rcPart.Height());
+			}
+		}
+	});
+
+	return S_OK;
+}
+
+void CMemSubPicEx::ConvertColor(BYTE* top, int pitch, int w, int h)
+{
+	const BYTE* bottom = top + pitch * h;
 
 	switch (m_alpha_blt_dst_type) {
 	case MSP_NV12:
@@ -168,7 +200,7 @@ STDMETHODIMP CMemSubPicEx::Unlock(RECT* pDirtyRect)
 	case MSP_P010:
 	case MSP_P016:
 	case MSP_YUY2:
-		for (; top < bottom; top += m_spd.pitch) {
+		for (; top < bottom; top += pitch) {
 			BYTE* s = top;
 			BYTE* e = s + w*4;
 			for(; s < e; s+=8) { // ARGB ARGB -> AxYU AxYV
@@ -188,7 +220,7 @@ STDMETHODIMP CMemSubPicEx::Unlock(RECT* pDirtyRect)
 		}
 		break;
 	case MSP_AYUV:
-		for (; top < bottom; top += m_spd.pitch) {
+		for (; top < bottom; top += pitch) {
 			BYTE* s = top;
 			BYTE* e = s + w*4;
 			for (; s < e; s+=4) { // ARGB -> AYUV
@@ -206,8 +238,6 @@ STDMETHODIMP CMemSubPicEx::Unlock(RECT* pDirtyRect)
 		}
 		break;
 	}
-
-	return S_OK;
 }
 
 static void AlphaBlt_YUY2_SSE2(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int srcpitch)
@@ -274,15 +304,8 @@ void AlphaBlt_YUY2_C(int w, int h, BYTE* d, int dstpitch, const BYTE* s, int src
 }
 */
 
-STDMETHODIMP CMemSubPicEx::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
+HRESULT CMemSubPicEx::AlphaBltDesc(const SubPicDesc& src, RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 {
-	ASSERT(pTarget);
-
-	if (!pSrc || !pDst || !pTarget) {
-		return E_POINTER;
-	}
-
-	const SubPicDesc& src = m_spd;
 	SubPicDesc dst = *pTarget;
 
 	if (m_alpha_blt_dst_type != dst.type) {
@@ -307,7 +330,7 @@ STDMETHODIMP CMemSubPicEx::AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget)
 	BYTE* d = dst.bits + dst.pitch * rd.top + rd.left * m_dst_packsize;
 
 	if (rd.top > rd.bottom) {
-		d = dst.bits + dst.pitch * (rd.top - 1) + rs.left * m_dst_packsize;
+		d = dst.bits + dst.pitch * (rd.top - 1) + rd.left * m_dst_packsize;
 		dst.pitch = -dst.pitch;
 	}
 
@@ -589,12 +612,16 @@ bool CMemSubPicExAllocator::Alloc(bool fStatic, ISubPic** ppSubPic)
 	spd.bpp   = 32;
 	spd.pitch = spd.w * 4;
 	spd.type  = MSP_RGB32;
-	spd.bits  = new(std::nothrow) BYTE[spd.pitch * spd.h];
-	if (!spd.bits) {
-		return false;
+
+	// only the static subpic is rendered to directly, the queued dynamic ones are sparse
+	if (fStatic) {
+		spd.bits = new(std::nothrow) BYTE[spd.pitch * spd.h];
+		if (!spd.bits) {
+			return false;
+		}
 	}
 
-	*ppSubPic = DNew CMemSubPicEx(spd, m_alpha_blt_dst_type);
+	*ppSubPic = DNew CMemSubPicEx(spd, m_alpha_blt_dst_type, !fStatic);
 	if (!(*ppSubPic)) {
 		return false;
 	}
@@ -30,12 +30,15 @@ protected:
 	const int m_alpha_blt_dst_type;
 	int m_dst_packsize = 0;
 
+	void ConvertColor(BYTE* top, int pitch, int w, int h);
+
+	HRESULT AlphaBltDesc(const SubPicDesc& src, RECT* pSrc, RECT* pDst, SubPicDesc* pTarget) override;
+
 public:
-	CMemSubPicEx(SubPicDesc& spd, int alpha_blt_dst_type);
+	CMemSubPicEx(SubPicDesc& spd, int alpha_blt_dst_type, bool bSparse = false);
 
 	// ISubPic
 	STDMETHODIMP Unlock(RECT* pDirtyRect) override;
-	STDMETHODIMP AlphaBlt(RECT* pSrc, RECT* pDst, SubPicDesc* pTarget) override;
 };
 
 // CMemSubPicExAllocator
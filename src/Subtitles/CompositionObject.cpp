@@ -55,6 +55,8 @@ void CompositionObject::SetRLEData(const BYTE* pBuffer, int nSize, int nTotalSiz
 	m_nRLEPos		= std::min(nSize, nTotalSize);
 
 	memcpy(m_pRLEData, pBuffer, std::min(nSize, nTotalSize));
+
+	InvalidateDecodedRuns();
 }
 
 void CompositionObject::AppendRLEData(const BYTE* pBuffer, int nSize)
@@ -63,6 +65,35 @@ void CompositionObject::AppendRLEData(const BYTE* pBuffer, int nSize)
 	if (m_nRLEPos + nSize <= m_nRLEDataSize) {
 		memcpy(m_pRLEData + m_nRLEPos, pBuffer, nSize);
 		m_nRLEPos += nSize;
+
+		InvalidateDecodedRuns();
+	}
+}
+
+void CompositionObject::InvalidateDecodedRuns()
+{
+	m_decodedRuns.clear();
+	m_bDecoded = false;
+}
+
+void CompositionObject::AddRun(SHORT nX, SHORT nY, SHORT nCount, BYTE nPaletteIndex)
+{
+	if (m_decodedRuns.size()) {
+		// merge with the previous run when it continues it
+		DecodedRun& last = m_decodedRuns.back();
+		if (last.y == nY && last.index == nPaletteIndex && last.x + last.count == nX) {
+			last.count += nCount;
+			return;
+		}
+	}
+
+	m_decodedRuns.push_back({ nX, nY, nCount, nPaletteIndex });
+}
+
+void CompositionObject::DrawRuns(SubPicDesc& spd, int nX, int nY)
+{
+	for (const auto& run : m_decodedRuns) {
+		FillSolidRect(spd, nX + run.x, nY + run.y, run.count, 1, m_Colors[run.index]);
 	}
 }
 
@@ -72,16 +103,27 @@ void CompositionObject::RenderHdmv(SubPicDesc& spd, SubPicDesc* spdResized)
 		return;
 	}
 
+	if (!IsDecoded()) {
+		DecodeHdmv();
+	}
+
+	DrawRuns(spdResized ? *spdResized : spd, m_horizontal_position, m_vertical_position);
+}
+
+void CompositionObject::DecodeHdmv()
+{
+	InvalidateDecodedRuns();
+
 	CGolombBuffer	GBuffer (m_pRLEData, m_nRLEDataSize);
 	BYTE			bTemp;
 	BYTE			bSwitch;
 
 	BYTE			nPaletteIndex = 0;
 	SHORT			nCount;
-	SHORT			nX	= m_horizontal_position;
-	SHORT			nY	= m_vertical_position;
+	SHORT			nX	= 0;
+	SHORT			nY	= 0;
 
-	while ((nY < (m_vertical_position + m_height)) && !GBuffer.IsEOF()) {
+	while ((nY < m_height) && !GBuffer.IsEOF()) {
 		bTemp = GBuffer.ReadByte();
 
 		nPaletteIndex = bTemp;
@@ -98,14 +140,18 @@ void CompositionObject::RenderHdmv(SubPicDesc& spd, SubPicDesc* spdResized)
 
 		if (nCount > 0) {
 			if (nPaletteIndex != 0xFF) {	// Fully transparent (section 9.14.4.2.2.1.1)
-				FillSolidRect(spdResized ? *spdResized : spd, nX, nY, nCount, 1, m_Colors[nPaletteIndex]);
+				AddRun(nX, nY, nCount, nPaletteIndex);
 			}
 			nX += nCount;
 		} else {
 			nY++;
-			nX = m_horizontal_position;
+			nX = 0;
 		}
 	}
+
+	m_bDecoded		= true;
+	m_decodedWidth	= m_width;
+	m_decodedHeight	= m_height;
 }
 
 void CompositionObject::RenderDvb(SubPicDesc& spd, SHORT nX, SHORT nY, SubPicDesc* spdResized)
@@ -114,6 +160,17 @@ void CompositionObject::RenderDvb(SubPicDesc& spd, SHORT nX, SHORT nY, SubPicDes
 		return;
 	}
 
+	if (!IsDecoded()) {
+		DecodeDvb();
+	}
+
+	DrawRuns(spdResized ? *spdResized : spd, nX, nY);
+}
+
+void CompositionObject::DecodeDvb()
+{
+	InvalidateDecodedRuns();
+
 	CGolombBuffer	gb(m_pRLEData, m_nRLEDataSize);
 	SHORT			sTopFieldLength;
 	SHORT			sBottomFieldLength;
@@ -121,11 +178,15 @@ void CompositionObject::RenderDvb(SubPicDesc& spd, SHORT nX, SHORT nY, SubPicDes
 	sTopFieldLength		= gb.ReadShort();
 	sBottomFieldLength	= gb.ReadShort();
 
-	DvbRenderField(spdResized ? *spdResized : spd, gb, nX, nY,   sTopFieldLength);
-	DvbRenderField(spdResized ? *spdResized : spd, gb, nX, nY+1, sBottomFieldLength);
+	DvbRenderField(gb, 0, 0, sTopFieldLength);
+	DvbRenderField(gb, 0, 1, sBottomFieldLength);
+
+	m_bDecoded		= true;
+	m_decodedWidth	= m_width;
+	m_decodedHeight	= m_height;
 }
 
-void CompositionObject::DvbRenderField(SubPicDesc& spd, CGolombBuffer& gb, SHORT nXStart, SHORT nYStart, SHORT nLength)
+void CompositionObject::DvbRenderField(CGolombBuffer& gb, SHORT nXStart, SHORT nYStart, SHORT nLength)
 {
 	//FillSolidRect (spd, 0,  0, 300, 10, 0xFFFF0000);	// Red opaque
 	//FillSolidRect (spd, 0, 10, 300, 10, 0xCC00FF00);	// Green 80%
@@ -138,13 +199,13 @@ void CompositionObject::DvbRenderField(SubPicDesc& spd, CGolombBuffer& gb, SHORT
 		BYTE bType = gb.ReadByte();
 		switch (bType) {
 			case 0x10 :
-				Dvb2PixelsCodeString(spd, gb, nX, nY);
+				Dvb2PixelsCodeString(gb, nX, nY);
 				break;
 			case 0x11 :
-				Dvb4PixelsCodeString(spd, gb, nX, nY);
+				Dvb4PixelsCodeString(gb, nX, nY);
 				break;
 			case 0x12 :
-				Dvb8PixelsCodeString(spd, gb, nX, nY);
+				Dvb8PixelsCodeString(gb, nX, nY);
 				break;
 			case 0x20 :
 				gb.SkipBytes (2);
@@ -166,7 +227,7 @@ void CompositionObject::DvbRenderField(SubPicDesc& spd, CGolombBuffer& gb, SHORT
 	}
 }
 
-void CompositionObject::Dvb2PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb, SHORT& nX, SHORT& nY)
+void CompositionObject::Dvb2PixelsCodeString(CGolombBuffer& gb, SHORT& nX, SHORT& nY)
 {
 	BYTE	bTemp;
 	BYTE	nPaletteIndex = 0;
@@ -214,7 +275,7 @@ void CompositionObject::Dvb2PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb,
 		}
 
 		if (nCount>0) {
-			FillSolidRect(spd, nX, nY, nCount, 1, m_Colors[nPaletteIndex]);
+			AddRun(nX, nY, nCount, nPaletteIndex);
 			nX += nCount;
 		}
 	}
@@ -222,7 +283,7 @@ void CompositionObject::Dvb2PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb,
 	gb.BitByteAlign();
 }
 
-void CompositionObject::Dvb4PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb, SHORT& nX, SHORT& nY)
+void CompositionObject::Dvb4PixelsCodeString(CGolombBuffer& gb, SHORT& nX, SHORT& nY)
 {
 	BYTE	bTemp;
 	BYTE	nPaletteIndex = 0;
@@ -277,7 +338,7 @@ void CompositionObject::Dvb4PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb,
 #endif
 
 		if (nCount>0) {
-			FillSolidRect(spd, nX, nY, nCount, 1, m_Colors[nPaletteIndex]);
+			AddRun(nX, nY, nCount, nPaletteIndex);
 			nX += nCount;
 		}
 	}
@@ -285,7 +346,7 @@ void CompositionObject::Dvb4PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb,
 	gb.BitByteAlign();
 }
 
-void CompositionObject::Dvb8PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb, SHORT& nX, SHORT& nY)
+void CompositionObject::Dvb8PixelsCodeString(CGolombBuffer& gb, SHORT& nX, SHORT& nY)
 {
 	BYTE	bTemp;
 	BYTE	nPaletteIndex = 0;
@@ -317,7 +378,7 @@ void CompositionObject::Dvb8PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb,
 		}
 
 		if (nCount>0) {
-			FillSolidRect(spd, nX, nY, nCount, 1, m_Colors[nPaletteIndex]);
+			AddRun(nX, nY, nCount, nPaletteIndex);
 			nX += nCount;
 		}
 	}
@@ -90,8 +90,29 @@ private :
 	int		m_nColorNumber	= 0;
 	DWORD	m_Colors[256];
 
-	void	DvbRenderField(SubPicDesc& spd, CGolombBuffer& gb, SHORT nXStart, SHORT nYStart, SHORT nLength);
-	void	Dvb2PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb, SHORT& nX, SHORT& nY);
-	void	Dvb4PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb, SHORT& nX, SHORT& nY);
-	void	Dvb8PixelsCodeString(SubPicDesc& spd, CGolombBuffer& gb, SHORT& nX, SHORT& nY);
+	// The RLE data decoded once into palette index runs, relative to the object origin.
+	// The runs don't depend on the palette, so they stay valid until the RLE data changes.
+	struct DecodedRun {
+		SHORT	x;
+		SHORT	y;
+		SHORT	count;
+		BYTE	index;
+	};
+	std::vector<DecodedRun> m_decodedRuns;
+	bool	m_bDecoded		= false;
+	SHORT	m_decodedWidth	= 0;
+	SHORT	m_decodedHeight	= 0;
+
+	void	InvalidateDecodedRuns();
+	bool	IsDecoded() const { return m_bDecoded && m_decodedWidth == m_width && m_decodedHeight == m_height; };
+	void	AddRun(SHORT nX, SHORT nY, SHORT nCount, BYTE nPaletteIndex);
+	void	DrawRuns(SubPicDesc& spd, int nX, int nY);
+
+	void	DecodeHdmv();
+	void	DecodeDvb();
+
+	void	DvbRenderField(CGolombBuffer& gb, SHORT nXStart, SHORT nYStart, SHORT nLength);
+	void	Dvb2PixelsCodeString(CGolombBuffer& gb, SHORT& nX, SHORT& nY);
+	void	Dvb4PixelsCodeString(CGolombBuffer& gb, SHORT& nX, SHORT& nY);
+	void	Dvb8PixelsCodeString(CGolombBuffer& gb, SHORT& nX, SHORT& nY);
 };
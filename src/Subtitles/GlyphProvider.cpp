@@ -0,0 +1,124 @@
+/*
+ * (C) 2026 see Authors.txt
+ *
+ * This file is part of MPC-BE.
+ *
+ * MPC-BE is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-BE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "stdafx.h"
+#include "GlyphProvider.h"
+#include "STS.h"
+
+// CGdiGlyphProvider
+
+CGdiGlyphProvider::CGdiGlyphProvider()
+{
+	m_hDC = CreateCompatibleDC(NULL);
+	SetBkMode(m_hDC, TRANSPARENT);
+	SetTextColor(m_hDC, 0xffffff);
+	SetMapMode(m_hDC, MM_TEXT);
+}
+
+CGdiGlyphProvider::~CGdiGlyphProvider()
+{
+	if (m_hOldFont) {
+		::SelectObject(m_hDC, m_hOldFont);
+	}
+	m_font.DeleteObject();
+	DeleteDC(m_hDC);
+}
+
+bool CGdiGlyphProvider::SetFont(const STSStyle& style)
+{
+	LOGFONTW lf;
+	ZeroMemory(&lf, sizeof(lf));
+	lf <<= style;
+	lf.lfHeight = (LONG)(style.fontSize+0.5);
+	lf.lfOutPrecision = OUT_TT_PRECIS;
+	lf.lfClipPrecision = CLIP_DEFAULT_PRECIS;
+	lf.lfQuality = ANTIALIASED_QUALITY;
+	lf.lfPitchAndFamily = DEFAULT_PITCH|FF_DONTCARE;
+	lf.lfCharSet = DEFAULT_CHARSET;
+
+	// consecutive words usually share the font
+	if (m_font.m_hObject && memcmp(&lf, &m_lf, sizeof(lf)) == 0) {
+		return true;
+	}
+
+	if (m_hOldFont) {
+		::SelectObject(m_hDC, m_hOldFont);
+		m_hOldFont = nullptr;
+	}
+	m_font.DeleteObject();
+	m_lf = lf;
+
+	if (!m_font.CreateFontIndirectW(&lf)) {
+		wcscpy_s(lf.lfFaceName, L"Arial");
+		if (!m_font.CreateFontIndirectW(&lf)) {
+			return false;
+		}
+	}
+
+	m_hOldFont = (HFONT)::SelectObject(m_hDC, m_font);
+
+	TEXTMETRICW tm;
+	EXECUTE_ASSERT(GetTextMetricsW(m_hDC, &tm));
+	m_ascent = ((tm.tmAscent + 4) >> 3);
+	m_descent = ((tm.tmDescent + 4) >> 3);
+
+	return true;
+}
+
+void CGdiGlyphProvider::GetFontMetrics(int& ascent, int& descent) const
+{
+	ascent  = m_ascent;
+	descent = m_descent;
+}
+
+bool CGdiGlyphProvider::GetTextExtent(LPCWSTR str, int len, CSize& extent)
+{
+	return !!GetTextExtentPoint32W(m_hDC, str, len, &extent);
+}
+
+bool CGdiGlyphProvider::GetTextPath(LPCWSTR str, int len, std::vector<BYTE>& types, std::vector<POINT>& points)
+{
+	types.clear();
+	points.clear();
+
+	::BeginPath(m_hDC);
+	TextOutW(m_hDC, 0, 0, str, len);
+	::CloseFigure(m_hDC);
+
+	if (::EndPath(m_hDC)) {
+		const int nPoints = GetPath(m_hDC, nullptr, nullptr, 0);
+		if (nPoints < 1) {
+			return true;
+		}
+
+		types.resize(nPoints);
+		points.resize(nPoints);
+		if (nPoints == GetPath(m_hDC, points.data(), types.data(), nPoints)) {
+			return true;
+		}
+
+		types.clear();
+		points.clear();
+	}
+
+	::AbortPath(m_hDC);
+
+	return false;
+}
@@ -0,0 +1,69 @@
+/*
+ * (C) 2026 see Authors.txt
+ *
+ * This file is part of MPC-BE.
+ *
+ * MPC-BE is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * MPC-BE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <vector>
+
+struct STSStyle;
+
+//
+// Font metrics and text outlines used by the text renderer.
+// Extents and outlines are in the 1/8 pixel units of the rasterizer,
+// the font metrics in pixels.
+//
+
+class CGlyphProvider
+{
+public:
+	virtual ~CGlyphProvider() = default;
+
+	// Sets the font used by the following calls
+	virtual bool SetFont(const STSStyle& style) = 0;
+
+	virtual void GetFontMetrics(int& ascent, int& descent) const = 0;
+	virtual bool GetTextExtent(LPCWSTR str, int len, CSize& extent) = 0;
+	// Outline of the string drawn at the origin, in the format of GetPath
+	virtual bool GetTextPath(LPCWSTR str, int len, std::vector<BYTE>& types, std::vector<POINT>& points) = 0;
+};
+
+//
+// GDI backend, each instance has its own device context
+//
+
+class CGdiGlyphProvider : public CGlyphProvider
+{
+	HDC m_hDC;
+	HFONT m_hOldFont = nullptr;
+	CFont m_font;
+	LOGFONTW m_lf = {};
+	int m_ascent  = 0;
+	int m_descent = 0;
+
+public:
+	CGdiGlyphProvider();
+	~CGdiGlyphProvider();
+
+	bool SetFont(const STSStyle& style) override;
+
+	void GetFontMetrics(int& ascent, int& descent) const override;
+	bool GetTextExtent(LPCWSTR str, int len, CSize& extent) override;
+	bool GetTextPath(LPCWSTR str, int len, std::vector<BYTE>& types, std::vector<POINT>& points) override;
+};
@@ -26,10 +26,6 @@
 
 #define MAXGDIFONTSIZE 15087
 
-// WARNING: this isn't very thread safe, use only one RTS a time. We should use TLS in future.
-static HDC g_hDC;
-static int g_hDC_refcnt = 0;
-
 static long revcolor(long c)
 {
 	return ((c & 0xff0000) >> 16) + (c & 0xff00) + ((c & 0xff) << 16);
@@ -46,31 +42,69 @@ void alpha_mask_deleter::operator()(CAlphaMask* ptr) const noexcept
 	}
 }
 
-// CMyFont
+// RenderingCaches
 
-CMyFont::CMyFont(STSStyle& style)
+void RenderingCaches::SetMemoryBudget(size_t maxBytes)
 {
-	LOGFONTW lf;
-	ZeroMemory(&lf, sizeof(lf));
-	lf <<= style;
-	lf.lfHeight = (LONG)(style.fontSize+0.5);
-	lf.lfOutPrecision = OUT_TT_PRECIS;
-	lf.lfClipPrecision = CLIP_DEFAULT_PRECIS;
-	lf.lfQuality = ANTIALIASED_QUALITY;
-	lf.lfPitchAndFamily = DEFAULT_PITCH|FF_DONTCARE;
-	lf.lfCharSet = DEFAULT_CHARSET;
+	memoryBudget.maxBytes = maxBytes;
+	memoryBudget.Shrink();
+}
 
-	if (!CreateFontIndirectW(&lf)) {
-		wcscpy_s(lf.lfFaceName, L"Arial");
-		CreateFontIndirectW(&lf);
+CRenderingCacheStats RenderingCaches::GetStats(int cache) const
+{
+	switch (cache) {
+		case TEXT_DIMS:  return textDimsCache.GetStats();
+		case POLYGON:    return polygonCache.GetStats();
+		case SSA_TAGS:   return SSATagsCache.GetStats();
+		case ELLIPSE:    return ellipseCache.GetStats();
+		case OUTLINE:    return outlineCache.GetStats();
+		case OVERLAY:    return overlayCache.GetStats();
+		case ALPHA_MASK: return alphaMaskCache.GetStats();
+		case GLYPH_PATH: return glyphPathCache.GetStats();
+		case COMPOSED:   return composedImages.GetStats();
 	}
 
-	HFONT hOldFont = SelectFont(g_hDC, *this);
-	TEXTMETRICW tm;
-	EXECUTE_ASSERT(GetTextMetricsW(g_hDC, &tm));
-	m_ascent = ((tm.tmAscent + 4) >> 3);
-	m_descent = ((tm.tmDescent + 4) >> 3);
-	SelectFont(g_hDC, hOldFont);
+	return {};
+}
+
+LPCWSTR RenderingCaches::GetName(int cache)
+{
+	static const LPCWSTR names[CACHE_COUNT] = {
+		L"TextDims",
+		L"Polygon",
+		L"SSATags",
+		L"Ellipse",
+		L"Outline",
+		L"Overlay",
+		L"AlphaMask",
+		L"GlyphPath",
+		L"Composed",
+	};
+
+	return cache >= 0 && cache < CACHE_COUNT ? names[cache] : L"";
+}
+
+void RenderingCaches::ResetStats()
+{
+	textDimsCache.ResetStats();
+	polygonCache.ResetStats();
+	SSATagsCache.ResetStats();
+	ellipseCache.ResetStats();
+	outlineCache.ResetStats();
+	overlayCache.ResetStats();
+	alphaMaskCache.ResetStats();
+	glyphPathCache.ResetStats();
+	composedImages.ResetStats();
+}
+
+void RenderingCaches::DumpStats(LPCWSTR name) const
+{
+	DLog(L"Rendering caches for '%s', %Iu of %Iu bytes used:", name, memoryBudget.usedBytes, memoryBudget.maxBytes);
+	for (int i = 0; i < CACHE_COUNT; i++) {
+		const CRenderingCacheStats stats = GetStats(i);
+		DLog(L"    %-10s entries: %5Iu/%-5Iu bytes: %10Iu, hits: %10I64u, misses: %10I64u, evictions: %10I64u",
+			 GetName(i), stats.count, stats.maxCount, stats.bytes, stats.hits, stats.misses, stats.evictions);
+	}
 }
 
 // CWord
@@ -94,6 +128,8 @@ CWord::CWord(const STSStyle& style, CStringW str, int ktype, int kstart, int ken
 	, m_scaley(scaley)
 	, m_renderingCaches(renderingCaches)
 {
+	m_pStats = &renderingCaches.rasterizerStats;
+
 	if (str.IsEmpty()) {
 		m_fWhiteSpaceChar = m_fLineBreak = true;
 	}
@@ -451,17 +487,17 @@ CText::CText(STSStyle& style, CStringW str, int ktype, int kstart, int kend, dou
 	CTextDimsKey textDimsKey(m_str, m_style);
 	CTextDims textDims;
 	if (!renderingCaches.textDimsCache.Lookup(textDimsKey, textDims)) {
-		CMyFont font(m_style);
-		m_ascent  = font.m_ascent;
-		m_descent = font.m_descent;
-
-		HFONT hOldFont = SelectFont(g_hDC, font);
+		CGlyphProvider* pGlyphProvider = renderingCaches.glyphProvider.get();
+		if (!pGlyphProvider->SetFont(m_style)) {
+			ASSERT(0);
+			return;
+		}
+		pGlyphProvider->GetFontMetrics(m_ascent, m_descent);
 
 		if (m_style.fontSpacing) {
 			for (LPCWSTR s = m_str; *s; s++) {
 				CSize extent;
-				if (!GetTextExtentPoint32W(g_hDC, s, 1, &extent)) {
-					SelectFont(g_hDC, hOldFont);
+				if (!pGlyphProvider->GetTextExtent(s, 1, extent)) {
 					ASSERT(0);
 					return;
 				}
@@ -470,16 +506,13 @@ CText::CText(STSStyle& style, CStringW str, int ktype, int kstart, int kend, dou
 			// m_width -= (int)m_style.fontSpacing; // TODO: subtract only at the end of the line
 		} else {
 			CSize extent;
-			if (!GetTextExtentPoint32W(g_hDC, m_str, str.GetLength(), &extent)) {
-				SelectFont(g_hDC, hOldFont);
+			if (!pGlyphProvider->GetTextExtent(m_str, str.GetLength(), extent)) {
 				ASSERT(0);
 				return;
 			}
 			m_width += extent.cx;
 		}
 
-		SelectFont(g_hDC, hOldFont);
-
 		textDims.ascent  = m_ascent;
 		textDims.descent = m_descent;
 		textDims.width   = m_width;
@@ -506,11 +539,108 @@ bool CText::Append(CWord* w)
 	return (dynamic_cast<CText*>(w) && CWord::Append(w));
 }
 
+bool CText::CanUseGlyphPaths() const
+{
+	// Underline and strikeout are drawn across the whole string and vertical fonts are laid out differently
+	if (m_str.IsEmpty() || m_style.fUnderline || m_style.fStrikeOut || m_style.fontName.IsEmpty() || m_style.fontName[0] == L'@') {
+		return false;
+	}
+
+	// Only characters without shaping, combining marks, bidi controls or ligatures can be drawn glyph by glyph
+	static const struct {
+		WCHAR first, last;
+	} ranges[] = {
+		{0x0020, 0x007E}, // Basic Latin
+		{0x00A0, 0x02FF}, // Latin-1, Latin Extended-A/B, IPA, spacing modifier letters
+		{0x0370, 0x0482}, // Greek, Cyrillic
+		{0x048A, 0x052F}, // Cyrillic, Cyrillic Supplement
+		{0x1E00, 0x1FFF}, // Latin Extended Additional, Greek Extended
+		{0x2000, 0x200A}, // spaces
+		{0x2010, 0x2027}, // dashes, quotation marks, bullets, ellipsis
+		{0x202F, 0x205F}, // per mille, primes, other punctuation
+		{0x2070, 0x20CF}, // superscripts, subscripts, currency symbols
+		{0x2100, 0x26FF}, // letterlike symbols, number forms, arrows, math, box drawing, shapes, symbols
+		{0x3000, 0x3029}, // CJK symbols and punctuation
+		{0x3030, 0x3098}, // Hiragana
+		{0x309B, 0x30FF}, // Katakana
+		{0x4E00, 0x9FFF}, // CJK Unified Ideographs
+		{0xAC00, 0xD7A3}, // Hangul syllables
+		{0xFF01, 0xFFEF}, // halfwidth and fullwidth forms
+	};
+
+	for (LPCWSTR s = m_str; *s; s++) {
+		const WCHAR c = *s;
+		if (c >= 0x0020 && c <= 0x007E) {
+			continue;
+		}
+
+		auto it = std::upper_bound(std::cbegin(ranges), std::cend(ranges), c, [](WCHAR c, const auto& range) {
+			return c < range.first;
+		});
+		if (it == std::cbegin(ranges) || c > (--it)->last) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool CText::CreatePathFromGlyphs()
+{
+	CGlyphProvider* pGlyphProvider = m_renderingCaches.glyphProvider.get();
+	bool bFontSet = false;
+
+	bool bFirstPath = true;
+	int width = 0;
+
+	for (LPCWSTR s = m_str; *s; s++) {
+		CGlyphPathKey glyphKey(*s, m_style);
+		CGlyphPathSharedPtr pGlyph;
+
+		if (!m_renderingCaches.glyphPathCache.Lookup(glyphKey, pGlyph)) {
+			if (!bFontSet) {
+				if (!pGlyphProvider->SetFont(m_style)) {
+					return false;
+				}
+				bFontSet = true;
+			}
+
+			CSize extent;
+			pGlyph = std::make_shared<CGlyphPath>();
+			if (!pGlyphProvider->GetTextExtent(s, 1, extent)
+					|| !pGlyphProvider->GetTextPath(s, 1, pGlyph->types, pGlyph->points)) {
+				return false;
+			}
+			pGlyph->advance = extent.cx;
+
+			m_renderingCaches.glyphPathCache.SetAt(glyphKey, pGlyph);
+		}
+
+		if (!AppendPath(pGlyph->types.data(), pGlyph->points.data(), (int)pGlyph->points.size(), width, 0, bFirstPath)) {
+			return false;
+		}
+		bFirstPath = false;
+
+		width += pGlyph->advance + (int)m_style.fontSpacing;
+	}
+
+	return true;
+}
+
 bool CText::CreatePath()
 {
-	CMyFont font(m_style);
+	if (CanUseGlyphPaths() && CreatePathFromGlyphs()) {
+		return true;
+	}
 
-	HFONT hOldFont = SelectFont(g_hDC, font);
+	CGlyphProvider* pGlyphProvider = m_renderingCaches.glyphProvider.get();
+	if (!pGlyphProvider->SetFont(m_style)) {
+		ASSERT(0);
+		return false;
+	}
+
+	std::vector<BYTE> types;
+	std::vector<POINT> points;
 
 	if (m_style.fontSpacing) {
 		int width = 0;
@@ -518,34 +648,26 @@ bool CText::CreatePath()
 
 		for (LPCWSTR s = m_str; *s; s++) {
 			CSize extent;
-			if (!GetTextExtentPoint32W(g_hDC, s, 1, &extent)) {
-				SelectFont(g_hDC, hOldFont);
+			if (!pGlyphProvider->GetTextExtent(s, 1, extent)) {
 				ASSERT(0);
 				return false;
 			}
 
-			PartialBeginPath(g_hDC, bFirstPath);
+			if (!pGlyphProvider->GetTextPath(s, 1, types, points)
+					|| !AppendPath(types.data(), points.data(), (int)points.size(), width, 0, bFirstPath)) {
+				return false;
+			}
 			bFirstPath = false;
-			TextOutW(g_hDC, 0, 0, s, 1);
-			PartialEndPath(g_hDC, width, 0);
 
 			width += extent.cx + (int)m_style.fontSpacing;
 		}
 	} else {
-		CSize extent;
-		if (!GetTextExtentPoint32W(g_hDC, m_str, m_str.GetLength(), &extent)) {
-			SelectFont(g_hDC, hOldFont);
-			ASSERT(0);
+		if (!pGlyphProvider->GetTextPath(m_str, m_str.GetLength(), types, points)
+				|| !AppendPath(types.data(), points.data(), (int)points.size(), 0, 0, true)) {
 			return false;
 		}
-
-		BeginPath(g_hDC);
-		TextOutW(g_hDC, 0, 0, m_str, m_str.GetLength());
-		EndPath(g_hDC);
 	}
 
-	SelectFont(g_hDC, hOldFont);
-
 	return true;
 }
 
@@ -1214,6 +1336,185 @@ CRect CLine::PaintBody(SubPicDesc& spd, CRect& clipRect, BYTE* pAlphaMask, CPoin
 }
 
 
+// CComposedSubtitle
+
+bool CComposedSubtitle::IsDrawnAsIs(const SubPicDesc& spd) const
+{
+	// Blending the image over the clear subpicture gives the pixels of the image, which were drawn
+	// from the clear color too. Over anything else the rounding of the stacked draws differs.
+	const int w = bbox.Width();
+	const __m128i transparent = _mm_set1_epi32(0xFF000000);
+
+	for (int y = bbox.top; y < bbox.bottom; y++) {
+		const DWORD* dst = (DWORD*)(spd.bits + spd.pitch * y) + bbox.left;
+		int x = 0;
+
+		for (; x + 4 <= w; x += 4) {
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i*)&dst[x]), transparent)) != 0xFFFF) {
+				return false;
+			}
+		}
+		for (; x < w; x++) {
+			if (dst[x] != 0xFF000000) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void CComposedSubtitle::Draw(SubPicDesc& spd) const
+{
+	// Each draw of the rasterizer keeps (256 - a) / 256 of the destination and adds the color,
+	// so the stacked draws are a single blend with the transparency and the color of the image.
+	const int w = bbox.Width();
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i transparent = _mm_set1_epi32(0xFF000000);
+	const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+
+	for (int y = bbox.top; y < bbox.bottom; y++) {
+		const DWORD* src = bits.data() + (y - bbox.top) * w;
+		DWORD* dst = (DWORD*)(spd.bits + spd.pitch * y) + bbox.left;
+		int x = 0;
+
+		for (; x + 4 <= w; x += 4) {
+			__m128i s = _mm_loadu_si128((__m128i*)&src[x]);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, transparent)) == 0xFFFF) {
+				continue;
+			}
+
+			// Spread (transparency + 1) over the 4 channels of each pixel
+			__m128i sLo = _mm_unpacklo_epi8(s, zero);
+			__m128i sHi = _mm_unpackhi_epi8(s, zero);
+			__m128i iaLo = _mm_add_epi16(_mm_shufflehi_epi16(_mm_shufflelo_epi16(sLo, 0xFF), 0xFF), one);
+			__m128i iaHi = _mm_add_epi16(_mm_shufflehi_epi16(_mm_shufflelo_epi16(sHi, 0xFF), 0xFF), one);
+
+			__m128i d = _mm_loadu_si128((__m128i*)&dst[x]);
+			__m128i dLo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), iaLo), 8);
+			__m128i dHi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), iaHi), 8);
+
+			d = _mm_adds_epu8(_mm_packus_epi16(dLo, dHi), _mm_and_si128(s, colorMask));
+			_mm_storeu_si128((__m128i*)&dst[x], d);
+		}
+		for (; x < w; x++) {
+			const DWORD s = src[x];
+			const DWORD ia = (s >> 24) + 1;
+			if (ia == 256) {
+				continue;
+			}
+
+			// same as the SSE2 path, the color channels are added with saturation
+			const DWORD d = dst[x];
+			const DWORD b = std::min<DWORD>((((d      ) & 0xff) * ia >> 8) + ((s      ) & 0xff), 255);
+			const DWORD g = std::min<DWORD>((((d >>  8) & 0xff) * ia >> 8) + ((s >>  8) & 0xff), 255);
+			const DWORD r = std::min<DWORD>((((d >> 16) & 0xff) * ia >> 8) + ((s >> 16) & 0xff), 255);
+			const DWORD a = ((d >> 24) * ia) >> 8;
+			dst[x] = (a << 24) | (r << 16) | (g << 8) | b;
+		}
+	}
+}
+
+// CComposedImages
+
+CComposedImages::CComposedImages(CRenderingCacheBudget& budget)
+	: m_budget(budget)
+{
+	m_budget.caches.push_back(this);
+}
+
+CComposedImages::~CComposedImages()
+{
+	// the subtitles holding the images are deleted before the caches
+	ASSERT(m_list.IsEmpty());
+	m_budget.usedBytes -= m_bytes;
+
+	auto& caches = m_budget.caches;
+	caches.erase(std::remove(caches.begin(), caches.end(), this), caches.end());
+}
+
+bool CComposedImages::Alloc(CComposedSubtitle& composed)
+{
+	ASSERT(!composed.pos);
+
+	const size_t size = (size_t)composed.bbox.Width() * composed.bbox.Height() * sizeof(DWORD);
+	// a single image may not take more than a quarter of the budget
+	if (m_budget.maxBytes && size > m_budget.maxBytes / 4) {
+		return false;
+	}
+
+	while (m_budget.IsOverBudget(size) && m_budget.EvictFromLargest()) {
+	}
+	if (m_budget.IsOverBudget(size)) {
+		return false;
+	}
+
+	composed.bits.assign(size / sizeof(DWORD), 0xFF000000);
+	composed.pos = m_list.AddHead(&composed);
+	m_bytes += size;
+	m_budget.usedBytes += size;
+	m_misses++;
+
+	return true;
+}
+
+void CComposedImages::Touch(CComposedSubtitle& composed)
+{
+	ASSERT(composed.pos);
+
+	m_list.MoveToHead(composed.pos);
+	m_hits++;
+}
+
+void CComposedImages::Free(CComposedSubtitle& composed)
+{
+	if (composed.pos) {
+		const size_t size = composed.bits.size() * sizeof(DWORD);
+		m_bytes -= size;
+		m_budget.usedBytes -= size;
+		m_list.RemoveAt(composed.pos);
+		composed.pos = nullptr;
+	}
+
+	composed.bits.clear();
+	composed.bits.shrink_to_fit();
+}
+
+size_t CComposedImages::GetBytes() const
+{
+	// only the images that can be evicted
+	return m_list.GetCount() > 1 ? m_bytes - m_list.GetHead()->bits.size() * sizeof(DWORD) : 0;
+}
+
+bool CComposedImages::EvictOldest()
+{
+	if (m_list.GetCount() <= 1) {
+		return false;
+	}
+
+	Free(*m_list.GetTail());
+	m_evictions++;
+
+	return true;
+}
+
+CRenderingCacheStats CComposedImages::GetStats() const
+{
+	CRenderingCacheStats stats;
+	stats.count     = m_list.GetCount();
+	stats.bytes     = m_bytes;
+	stats.hits      = m_hits;
+	stats.misses    = m_misses;
+	stats.evictions = m_evictions;
+	return stats;
+}
+
+void CComposedImages::ResetStats()
+{
+	m_hits = m_misses = m_evictions = 0;
+}
+
 // CSubtitle
 
 CSubtitle::CSubtitle(RenderingCaches& renderingCaches)
@@ -1236,6 +1537,8 @@ CSubtitle::CSubtitle(RenderingCaches& renderingCaches)
 CSubtitle::~CSubtitle()
 {
 	Empty();
+
+	m_renderingCaches.composedImages.Free(m_composed);
 }
 
 void CSubtitle::Empty()
@@ -1568,8 +1871,6 @@ CRect CScreenLayoutAllocator::AllocRect(const CSubtitle* s, int segment, int ent
 
 // CRenderedTextSubtitle
 
-CAtlMap<CStringW, SSATagCmd, CStringElementTraits<CStringW>> CRenderedTextSubtitle::s_SSATagCmds;
-
 CRenderedTextSubtitle::CRenderedTextSubtitle(CCritSec* pLock)
 	: CSubPicProviderImpl(pLock)
 	, m_time(0)
@@ -1588,82 +1889,16 @@ CRenderedTextSubtitle::CRenderedTextSubtitle(CCritSec* pLock)
 	, m_webvtt_allow_clear(false)
 {
 	m_size = CSize(0, 0);
-
-	if (g_hDC_refcnt == 0) {
-		g_hDC = CreateCompatibleDC(NULL);
-		SetBkMode(g_hDC, TRANSPARENT);
-		SetTextColor(g_hDC, 0xffffff);
-		SetMapMode(g_hDC, MM_TEXT);
-	}
-
-	g_hDC_refcnt++;
-
-	if (s_SSATagCmds.IsEmpty()) {
-		s_SSATagCmds[L"1c"] = SSA_1c;
-		s_SSATagCmds[L"2c"] = SSA_2c;
-		s_SSATagCmds[L"3c"] = SSA_3c;
-		s_SSATagCmds[L"4c"] = SSA_4c;
-		s_SSATagCmds[L"1a"] = SSA_1a;
-		s_SSATagCmds[L"2a"] = SSA_2a;
-		s_SSATagCmds[L"3a"] = SSA_3a;
-		s_SSATagCmds[L"4a"] = SSA_4a;
-		s_SSATagCmds[L"alpha"] = SSA_alpha;
-		s_SSATagCmds[L"an"] = SSA_an;
-		s_SSATagCmds[L"a"] = SSA_a;
-		s_SSATagCmds[L"blur"] = SSA_blur;
-		s_SSATagCmds[L"bord"] = SSA_bord;
-		s_SSATagCmds[L"be"] = SSA_be;
-		s_SSATagCmds[L"b"] = SSA_b;
-		s_SSATagCmds[L"clip"] = SSA_clip;
-		s_SSATagCmds[L"iclip"] = SSA_iclip;
-		s_SSATagCmds[L"c"] = SSA_c;
-		s_SSATagCmds[L"fade"] = SSA_fade;
-		s_SSATagCmds[L"fad"] = SSA_fade;
-		s_SSATagCmds[L"fax"] = SSA_fax;
-		s_SSATagCmds[L"fay"] = SSA_fay;
-		s_SSATagCmds[L"fe"] = SSA_fe;
-		s_SSATagCmds[L"fn"] = SSA_fn;
-		s_SSATagCmds[L"frx"] = SSA_frx;
-		s_SSATagCmds[L"fry"] = SSA_fry;
-		s_SSATagCmds[L"frz"] = SSA_frz;
-		s_SSATagCmds[L"fr"] = SSA_fr;
-		s_SSATagCmds[L"fscx"] = SSA_fscx;
-		s_SSATagCmds[L"fscy"] = SSA_fscy;
-		s_SSATagCmds[L"fsc"] = SSA_fsc;
-		s_SSATagCmds[L"fsp"] = SSA_fsp;
-		s_SSATagCmds[L"fs"] = SSA_fs;
-		s_SSATagCmds[L"i"] = SSA_i;
-		s_SSATagCmds[L"kt"] = SSA_kt;
-		s_SSATagCmds[L"kf"] = SSA_kf;
-		s_SSATagCmds[L"K"] = SSA_K;
-		s_SSATagCmds[L"ko"] = SSA_ko;
-		s_SSATagCmds[L"k"] = SSA_k;
-		s_SSATagCmds[L"move"] = SSA_move;
-		s_SSATagCmds[L"org"] = SSA_org;
-		s_SSATagCmds[L"pbo"] = SSA_pbo;
-		s_SSATagCmds[L"pos"] = SSA_pos;
-		s_SSATagCmds[L"p"] = SSA_p;
-		s_SSATagCmds[L"q"] = SSA_q;
-		s_SSATagCmds[L"r"] = SSA_r;
-		s_SSATagCmds[L"shad"] = SSA_shad;
-		s_SSATagCmds[L"s"] = SSA_s;
-		s_SSATagCmds[L"t"] = SSA_t;
-		s_SSATagCmds[L"u"] = SSA_u;
-		s_SSATagCmds[L"xbord"] = SSA_xbord;
-		s_SSATagCmds[L"xshad"] = SSA_xshad;
-		s_SSATagCmds[L"ybord"] = SSA_ybord;
-		s_SSATagCmds[L"yshad"] = SSA_yshad;
-	}
 }
 
 CRenderedTextSubtitle::~CRenderedTextSubtitle()
 {
-	Deinit();
+#if RASTERIZER_STATS
+	m_renderingCaches.rasterizerStats.Dump(m_name);
+	m_renderingCaches.DumpStats(m_name);
+#endif
 
-	g_hDC_refcnt--;
-	if (g_hDC_refcnt == 0) {
-		DeleteDC(g_hDC);
-	}
+	Deinit();
 }
 
 void CRenderedTextSubtitle::Copy(CSimpleTextSubtitle& sts)
@@ -1688,6 +1923,13 @@ void CRenderedTextSubtitle::OnChanged()
 {
 	__super::OnChanged();
 
+	ClearSubtitleCache();
+
+	m_sla.Empty();
+}
+
+void CRenderedTextSubtitle::ClearSubtitleCache()
+{
 	POSITION pos = m_subtitleCache.GetStartPosition();
 	while (pos) {
 		int i;
@@ -1697,8 +1939,7 @@ void CRenderedTextSubtitle::OnChanged()
 	}
 
 	m_subtitleCache.RemoveAll();
-
-	m_sla.Empty();
+	m_subtitleCacheExpiry = {};
 }
 
 bool CRenderedTextSubtitle::Init(CSize size, const CRect& vidrect)
@@ -1715,15 +1956,7 @@ bool CRenderedTextSubtitle::Init(CSize size, const CRect& vidrect)
 
 void CRenderedTextSubtitle::Deinit()
 {
-	POSITION pos = m_subtitleCache.GetStartPosition();
-	while (pos) {
-		int i;
-		CSubtitle* s;
-		m_subtitleCache.GetNextAssoc(pos, i, s);
-		delete s;
-	}
-
-	m_subtitleCache.RemoveAll();
+	ClearSubtitleCache();
 
 	m_sla.Empty();
 
@@ -1856,6 +2089,74 @@ void CRenderedTextSubtitle::ParsePolygon(CSubtitle* sub, CStringW str, STSStyle&
 	}
 }
 
+// SSA override tags, the longest name matching the start of a tag wins
+static const struct {
+	LPCWSTR name;
+	int length;
+	SSATagCmd cmd;
+} s_SSATagCmds[] = {
+	{ L"1c",    2, SSA_1c    }, { L"2c",    2, SSA_2c    }, { L"3c",    2, SSA_3c    }, { L"4c",    2, SSA_4c    },
+	{ L"1a",    2, SSA_1a    }, { L"2a",    2, SSA_2a    }, { L"3a",    2, SSA_3a    }, { L"4a",    2, SSA_4a    },
+	{ L"alpha", 5, SSA_alpha }, { L"an",    2, SSA_an    }, { L"a",     1, SSA_a     },
+	{ L"blur",  4, SSA_blur  }, { L"bord",  4, SSA_bord  }, { L"be",    2, SSA_be    }, { L"b",     1, SSA_b     },
+	{ L"clip",  4, SSA_clip  }, { L"iclip", 5, SSA_iclip }, { L"c",     1, SSA_c     },
+	{ L"fade",  4, SSA_fade  }, { L"fad",   3, SSA_fade  }, { L"fax",   3, SSA_fax   }, { L"fay",   3, SSA_fay   },
+	{ L"fe",    2, SSA_fe    }, { L"fn",    2, SSA_fn    }, { L"frx",   3, SSA_frx   }, { L"fry",   3, SSA_fry   },
+	{ L"frz",   3, SSA_frz   }, { L"fr",    2, SSA_fr    }, { L"fscx",  4, SSA_fscx  }, { L"fscy",  4, SSA_fscy  },
+	{ L"fsc",   3, SSA_fsc   }, { L"fsp",   3, SSA_fsp   }, { L"fs",    2, SSA_fs    }, { L"i",     1, SSA_i     },
+	{ L"kt",    2, SSA_kt    }, { L"kf",    2, SSA_kf    }, { L"K",     1, SSA_K     }, { L"ko",    2, SSA_ko    },
+	{ L"k",     1, SSA_k     }, { L"move",  4, SSA_move  }, { L"org",   3, SSA_org   }, { L"pbo",   3, SSA_pbo   },
+	{ L"pos",   3, SSA_pos   }, { L"p",     1, SSA_p     }, { L"q",     1, SSA_q     }, { L"r",     1, SSA_r     },
+	{ L"shad",  4, SSA_shad  }, { L"s",     1, SSA_s     }, { L"t",     1, SSA_t     }, { L"u",     1, SSA_u     },
+	{ L"xbord", 5, SSA_xbord }, { L"xshad", 5, SSA_xshad }, { L"ybord", 5, SSA_ybord }, { L"yshad", 5, SSA_yshad },
+};
+
+static SSATagCmd GetSSATagCmd(LPCWSTR cmd, int length)
+{
+	SSATagCmd ret = SSA_unknown;
+	int retLength = 0;
+
+	for (const auto& tagCmd : s_SSATagCmds) {
+		if (tagCmd.name[0] == cmd[0] && tagCmd.length > retLength && tagCmd.length <= length
+				&& wcsncmp(tagCmd.name, cmd, tagCmd.length) == 0) {
+			ret = tagCmd.cmd;
+			retLength = tagCmd.length;
+		}
+	}
+
+	return ret;
+}
+
+// A part of the tags string, not null-terminated
+struct SSATagParam {
+	LPCWSTR str;
+	int length;
+};
+
+static SSATagParam TrimSSATagParam(LPCWSTR str, int length, bool bKeepEllipsis)
+{
+	while (length > 0 && CStringW::StrTraits::IsSpace(*str)) {
+		str++;
+		length--;
+	}
+	while (length > 0 && CStringW::StrTraits::IsSpace(str[length - 1]) && !(bKeepEllipsis && str[length - 1] == 133)) {
+		length--;
+	}
+
+	return { str, length };
+}
+
+// Parses a hexadecimal color or alpha value like "&H00FF00&"
+static int ParseSSATagHex(LPCWSTR str, int length)
+{
+	while (length > 0 && (*str == L'&' || *str == L'H')) {
+		str++;
+		length--;
+	}
+
+	return length > 0 ? wcstol(str, NULL, 16) : 0;
+}
+
 bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& str)
 {
 	if (m_renderingCaches.SSATagsCache.Lookup(str, tagsList)) {
@@ -1865,68 +2166,93 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 	int nTags = 0, nUnrecognizedTags = 0;
 	tagsList.reset(DNew CAtlList<SSATag>());
 
+	// The tags and their numeric parameters are parsed in place,
+	// only the parameters kept as strings are copied.
+	const LPCWSTR s = str;
+
 	for (int pos = 0, j; (j = str.Find(L'\\', pos)) >= 0; pos = j) {
 		int jOld;
 		// find the end of the current tag or the start of its parameters
-		for (jOld = ++j; str[j] && str[j] != L'(' && str[j] != L'\\'; ++j) {
+		for (jOld = ++j; s[j] && s[j] != L'(' && s[j] != L'\\'; ++j) {
 			;
 		}
-		CStringW cmd = str.Mid(jOld, j - jOld);
-		FastTrim(cmd);
-		if (cmd.IsEmpty()) {
+		const SSATagParam cmd = TrimSSATagParam(s + jOld, j - jOld, true);
+		if (!cmd.length) {
 			continue;
 		}
 
 		nTags++;
 
 		SSATag tag;
-		tag.cmd = SSA_unknown;
-		for (int cmdLength = std::min(SSA_CMD_MAX_LENGTH, cmd.GetLength()), cmdLengthMin = SSA_CMD_MIN_LENGTH; cmdLength >= cmdLengthMin; cmdLength--) {
-			if (s_SSATagCmds.Lookup(cmd.Left(cmdLength), tag.cmd)) {
-				break;
-			}
-		}
+		tag.cmd = GetSSATagCmd(cmd.str, cmd.length);
 		if (tag.cmd == SSA_unknown) {
 			nUnrecognizedTags++;
 			continue;
 		}
 
-		if (str[j] == L'(') {
+		SSATagParam params[8];
+		size_t nParams = 0;
+		auto AddParam = [&](const SSATagParam& param) {
+			if (!param.length) {
+				return;
+			}
+			if (nParams < std::size(params)) {
+				params[nParams] = param;
+			} else {
+				// too many for the in place parsing, keep them all as strings
+				if (nParams == std::size(params)) {
+					for (const auto& p : params) {
+						tag.params.Add(CStringW(p.str, p.length));
+					}
+				}
+				tag.params.Add(CStringW(param.str, param.length));
+			}
+			nParams++;
+		};
+
+		if (s[j] == L'(') {
 			// complex tags search
 			int br = 1; // 1 bracket
 			// find the end of the parameters
-			for (jOld = ++j; str[j] && br > 0; ++j) {
-				if (str[j] == L'(') {
+			for (jOld = ++j; s[j] && br > 0; ++j) {
+				if (s[j] == L'(') {
 					br++;
-				} else if (str[j] == L')') {
+				} else if (s[j] == L')') {
 					br--;
 				}
 				if (br == 0) {
 					break;
 				}
 			}
-			CStringW param = str.Mid(jOld, j - jOld);
-			FastTrim(param);
+			SSATagParam param = TrimSSATagParam(s + jOld, j - jOld, true);
 
-			while (!param.IsEmpty()) {
-				int k = param.Find(L','), l = param.Find(L'\\');
+			while (param.length) {
+				const LPCWSTR end = param.str + param.length;
+				LPCWSTR k = std::find(param.str, end, L',');
+				LPCWSTR l = std::find(param.str, end, L'\\');
 
-				if (k >= 0 && (l < 0 || k < l)) {
-					CStringW s = param.Left(k).Trim();
-					if (!s.IsEmpty()) {
-						tag.params.Add(s);
-					}
-					param = param.Mid(k + 1);
+				if (k != end && (l == end || k < l)) {
+					AddParam(TrimSSATagParam(param.str, int(k - param.str), false));
+					param = { k + 1, int(end - k - 1) };
 				} else {
-					FastTrim(param);
-					if (!param.IsEmpty()) {
-						tag.params.Add(param);
-					}
-					param.Empty();
+					AddParam(TrimSSATagParam(param.str, param.length, true));
+					param.length = 0;
 				}
 			}
 		}
 
+		auto ParamInt = [&](size_t i) {
+			return wcstol(params[i].str, NULL, 10);
+		};
+		auto ParamReal = [&](size_t i) {
+			return wcstod(params[i].str, NULL);
+		};
+
+		// The numeric values that follow the tag name end with it,
+		// the character after a trimmed tag can't continue a number.
+		LPCWSTR value = cmd.str;
+		bool bParamsUsed = false;
+
 		switch (tag.cmd) {
 			case SSA_1c:
 			case SSA_2c:
@@ -1936,13 +2262,13 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 			case SSA_2a:
 			case SSA_3a:
 			case SSA_4a:
-				if (cmd.GetLength() > 2) {
-					tag.paramsInt.Add(wcstol(cmd.Mid(2).Trim(L"&H"), NULL, 16));
+				if (cmd.length > 2) {
+					tag.paramsInt.Add(ParseSSATagHex(value + 2, cmd.length - 2));
 				}
 				break;
 			case SSA_alpha:
-				if (cmd.GetLength() > 5) {
-					tag.paramsInt.Add(wcstol(cmd.Mid(5).Trim(L"&H"), NULL, 16));
+				if (cmd.length > 5) {
+					tag.paramsInt.Add(ParseSSATagHex(value + 5, cmd.length - 5));
 				}
 				break;
 			case SSA_an:
@@ -1951,25 +2277,24 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 			case SSA_kt:
 			case SSA_kf:
 			case SSA_ko:
-				if (cmd.GetLength() > 2) {
-					tag.paramsInt.Add(wcstol(cmd.Mid(2), NULL, 10));
+				if (cmd.length > 2) {
+					tag.paramsInt.Add(wcstol(value + 2, NULL, 10));
 				}
 				break;
 			case SSA_fn:
-				tag.params.Add(cmd.Mid(2));
+				tag.params.Add(CStringW(value + 2, cmd.length - 2));
 				break;
 			case SSA_fr:
-				if (cmd.GetLength() > 2) {
-					tag.paramsReal.Add(wcstod(cmd.Mid(2), NULL));
+				if (cmd.length > 2) {
+					tag.paramsReal.Add(wcstod(value + 2, NULL));
 				}
 				break;
 			case SSA_fs:
-				if (cmd.GetLength() > 2) {
-					int s = 2;
-					if (cmd[s] == L'+' || cmd[s] == L'-') {
-						tag.params.Add(cmd.Mid(s, 1));
+				if (cmd.length > 2) {
+					if (value[2] == L'+' || value[2] == L'-') {
+						tag.params.Add(CStringW(value + 2, 1));
 					}
-					tag.paramsInt.Add(wcstol(cmd.Mid(s), NULL, 10));
+					tag.paramsInt.Add(wcstol(value + 2, NULL, 10));
 				}
 				break;
 			case SSA_a:
@@ -1981,73 +2306,66 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 			case SSA_q:
 			case SSA_s:
 			case SSA_u:
-				if (cmd.GetLength() > 1) {
-					tag.paramsInt.Add(wcstol(cmd.Mid(1), NULL, 10));
+				if (cmd.length > 1) {
+					tag.paramsInt.Add(wcstol(value + 1, NULL, 10));
 				}
 				break;
 			case SSA_r:
-				tag.params.Add(cmd.Mid(1));
+				tag.params.Add(CStringW(value + 1, cmd.length - 1));
 				break;
 			case SSA_blur:
 			case SSA_bord:
 			case SSA_fscx:
 			case SSA_fscy:
 			case SSA_shad:
-				if (cmd.GetLength() > 4) {
-					tag.paramsReal.Add(wcstod(cmd.Mid(4), NULL));
+				if (cmd.length > 4) {
+					tag.paramsReal.Add(wcstod(value + 4, NULL));
 				}
 				break;
 			case SSA_clip:
-			case SSA_iclip: {
-				size_t nParams = tag.params.GetCount();
+			case SSA_iclip:
 				if (nParams == 2) {
-					tag.paramsInt.Add(wcstol(tag.params[0], NULL, 10));
-					tag.params.RemoveAt(0);
+					tag.paramsInt.Add(ParamInt(0));
+					tag.params.Add(CStringW(params[1].str, params[1].length));
+					bParamsUsed = true;
 				} else if (nParams == 4) {
 					for (size_t i = 0; i < nParams; i++) {
-						tag.paramsInt.Add(wcstol(tag.params[i], NULL, 10));
+						tag.paramsInt.Add(ParamInt(i));
 					}
-					tag.params.RemoveAll();
+					bParamsUsed = true;
 				}
-			}
-			break;
-			case SSA_fade: {
-				size_t nParams = tag.params.GetCount();
+				break;
+			case SSA_fade:
 				if (nParams == 7 || nParams == 2) {
 					for (size_t i = 0; i < nParams; i++) {
-						tag.paramsInt.Add(wcstol(tag.params[i], NULL, 10));
+						tag.paramsInt.Add(ParamInt(i));
 					}
-					tag.params.RemoveAll();
+					bParamsUsed = true;
 				}
-			}
-			break;
-			case SSA_move: {
-				size_t nParams = tag.params.GetCount();
+				break;
+			case SSA_move:
 				if (nParams == 4 || nParams == 6) {
 					for (size_t i = 0; i < 4; i++) {
-						tag.paramsReal.Add(wcstod(tag.params[i], NULL));
+						tag.paramsReal.Add(ParamReal(i));
 					}
 					for (size_t i = 4; i < nParams; i++) {
-						tag.paramsInt.Add(wcstol(tag.params[i], NULL, 10));
+						tag.paramsInt.Add(ParamInt(i));
 					}
-					tag.params.RemoveAll();
+					bParamsUsed = true;
 				}
-			}
-			break;
+				break;
 			case SSA_org:
-			case SSA_pos: {
-				size_t nParams = tag.params.GetCount();
+			case SSA_pos:
 				if (nParams == 2) {
 					for (size_t i = 0; i < nParams; i++) {
-						tag.paramsReal.Add(wcstod(tag.params[i], NULL));
+						tag.paramsReal.Add(ParamReal(i));
 					}
-					tag.params.RemoveAll();
+					bParamsUsed = true;
 				}
-			}
-			break;
+				break;
 			case SSA_c:
-				if (cmd.GetLength() > 1) {
-					tag.paramsInt.Add(wcstol(cmd.Mid(1).Trim(L"&H"), NULL, 16));
+				if (cmd.length > 1) {
+					tag.paramsInt.Add(ParseSSATagHex(value + 1, cmd.length - 1));
 				}
 				break;
 			case SSA_frx:
@@ -2057,44 +2375,50 @@ bool CRenderedTextSubtitle::ParseSSATag(SSATagsList& tagsList, const CStringW& s
 			case SSA_fay:
 			case SSA_fsc:
 			case SSA_fsp:
-				if (cmd.GetLength() > 3) {
-					tag.paramsReal.Add(wcstod(cmd.Mid(3), NULL));
+				if (cmd.length > 3) {
+					tag.paramsReal.Add(wcstod(value + 3, NULL));
 				}
 				break;
 			case SSA_pbo:
-				if (cmd.GetLength() > 3) {
-					tag.paramsInt.Add(wcstol(cmd.Mid(3), NULL, 10));
+				if (cmd.length > 3) {
+					tag.paramsInt.Add(wcstol(value + 3, NULL, 10));
 				}
 				break;
-			case SSA_t: {
-				size_t nParams = tag.params.GetCount();
+			case SSA_t:
 				if (nParams >= 1 && nParams <= 4) {
 					if (nParams == 2) {
-						tag.paramsReal.Add(wcstod(tag.params[0], NULL));
+						tag.paramsReal.Add(ParamReal(0));
 					} else if (nParams == 3) {
-						tag.paramsReal.Add(wcstod(tag.params[0], NULL));
-						tag.paramsReal.Add(wcstod(tag.params[1], NULL));
+						tag.paramsReal.Add(ParamReal(0));
+						tag.paramsReal.Add(ParamReal(1));
 					} else if (nParams == 4) {
-						tag.paramsInt.Add(wcstol(tag.params[0], NULL, 10));
-						tag.paramsInt.Add(wcstol(tag.params[1], NULL, 10));
-						tag.paramsReal.Add(wcstod(tag.params[2], NULL));
+						tag.paramsInt.Add(ParamInt(0));
+						tag.paramsInt.Add(ParamInt(1));
+						tag.paramsReal.Add(ParamReal(2));
 					}
 
-					ParseSSATag(tag.subTagsList, tag.params[nParams - 1]);
+					ParseSSATag(tag.subTagsList, CStringW(params[nParams - 1].str, params[nParams - 1].length));
 				}
 				tag.params.RemoveAll();
-			}
-			break;
+				bParamsUsed = true;
+				break;
 			case SSA_xbord:
 			case SSA_xshad:
 			case SSA_ybord:
 			case SSA_yshad:
-				if (cmd.GetLength() > 5) {
-					tag.paramsReal.Add(wcstod(cmd.Mid(5), NULL));
+				if (cmd.length > 5) {
+					tag.paramsReal.Add(wcstod(value + 5, NULL));
 				}
 				break;
 		}
 
+		// the parameters not converted above are kept as strings
+		if (!bParamsUsed && nParams <= std::size(params)) {
+			for (size_t i = 0; i < nParams; i++) {
+				tag.params.Add(CStringW(params[i].str, params[i].length));
+			}
+		}
+
 		tagsList->AddTail(tag);
 	}
 
@@ -2674,7 +2998,8 @@ double CRenderedTextSubtitle::CalcAnimation(double dst, double src, bool fAnimat
 CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
 {
 	CSubtitle* sub;
-	if (m_subtitleCache.Lookup(entry, sub)) {
+	const bool bCached = m_subtitleCache.Lookup(entry, sub);
+	if (bCached) {
 		if (sub->m_fAnimated) {
 			delete sub;
 			sub = NULL;
@@ -2890,6 +3215,9 @@ CSubtitle* CRenderedTextSubtitle::GetSubtitle(int entry)
 	sub->MakeLines(m_size, marginRect);
 
 	m_subtitleCache[entry] = sub;
+	if (!bCached) {
+		m_subtitleCacheExpiry.emplace(GetAt(entry).end, entry);
+	}
 
 	return sub;
 }
@@ -2963,6 +3291,45 @@ const bool CRenderedTextSubtitle::GetText(const REFERENCE_TIME rt, const double
 	return !text.IsEmpty();
 }
 
+RasterizerStats CRenderedTextSubtitle::GetRasterizerStats()
+{
+	std::unique_lock<std::mutex> lock(m_mutexRender);
+
+	return m_renderingCaches.rasterizerStats;
+}
+
+CRenderingCacheStats CRenderedTextSubtitle::GetRenderingCacheStats(int cache)
+{
+	std::unique_lock<std::mutex> lock(m_mutexRender);
+
+	return m_renderingCaches.GetStats(cache);
+}
+
+void CRenderedTextSubtitle::ResetStats()
+{
+	std::unique_lock<std::mutex> lock(m_mutexRender);
+
+	m_renderingCaches.rasterizerStats.Reset();
+	m_renderingCaches.ResetStats();
+}
+
+void CRenderedTextSubtitle::DumpStats()
+{
+	std::unique_lock<std::mutex> lock(m_mutexRender);
+
+#if RASTERIZER_STATS
+	m_renderingCaches.rasterizerStats.Dump(m_name);
+#endif
+	m_renderingCaches.DumpStats(m_name);
+}
+
+void CRenderedTextSubtitle::SetRenderingCacheBudget(size_t maxBytes)
+{
+	std::unique_lock<std::mutex> lock(m_mutexRender);
+
+	m_renderingCaches.SetMemoryBudget(maxBytes);
+}
+
 void CRenderedTextSubtitle::SetSubtitleTypeFromGUID(GUID subtype) {
 	if (subtype == MEDIASUBTYPE_UTF8) {
 		m_subtitleType = Subtitle::SRT;
@@ -3050,6 +3417,84 @@ STDMETHODIMP_(bool) CRenderedTextSubtitle::IsAnimated(POSITION pos)
 	return false;
 }
 
+CRect CRenderedTextSubtitle::PaintSubtitle(SubPicDesc& spd, CSubtitle* s, const CRect& clipRect, const CRect& bounds, BYTE* pAlphaMask,
+										   CPoint org, CPoint org2, int top, int alpha)
+{
+	CRect bbox(0, 0, 0, 0);
+
+	CPoint p, p2(0, top);
+	p = p2;
+
+	// Rectangles for inverse clip
+	CRect iclipRect[4];
+	iclipRect[0] = CRect(0, 0, spd.w, clipRect.top);
+	iclipRect[1] = CRect(0, clipRect.top, clipRect.left, clipRect.bottom);
+	iclipRect[2] = CRect(clipRect.right, clipRect.top, spd.w, clipRect.bottom);
+	iclipRect[3] = CRect(0, clipRect.bottom, spd.w, spd.h);
+	for (auto& rc : iclipRect) {
+		rc &= bounds;
+	}
+	CRect clip = clipRect & bounds;
+
+	POSITION pos = s->GetHeadPosition();
+	while (pos) {
+		CLine* l = s->GetNext(pos);
+
+		p.x = (s->m_scrAlignment % 3) == 1 ? org.x
+			: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
+			:                                org.x - (l->m_width / 2);
+		if (s->m_clipInverse) {
+			bbox |= l->PaintShadow(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintShadow(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintShadow(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintShadow(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
+		} else {
+			bbox |= l->PaintShadow(spd, clip, pAlphaMask, p, org2, m_time, alpha);
+		}
+		p.y += l->m_ascent + l->m_descent;
+	}
+
+	p = p2;
+	pos = s->GetHeadPosition();
+	while (pos) {
+		CLine* l = s->GetNext(pos);
+
+		p.x = (s->m_scrAlignment % 3) == 1 ? org.x
+			: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
+			:                                org.x - (l->m_width / 2);
+		if (s->m_clipInverse) {
+			bbox |= l->PaintOutline(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintOutline(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintOutline(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintOutline(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
+		} else {
+			bbox |= l->PaintOutline(spd, clip, pAlphaMask, p, org2, m_time, alpha);
+		}
+		p.y += l->m_ascent + l->m_descent;
+	}
+
+	p = p2;
+	pos = s->GetHeadPosition();
+	while (pos) {
+		CLine* l = s->GetNext(pos);
+
+		p.x = (s->m_scrAlignment % 3) == 1 ? org.x
+			: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
+			:                                org.x - (l->m_width / 2);
+		if (s->m_clipInverse) {
+			bbox |= l->PaintBody(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintBody(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintBody(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
+			bbox |= l->PaintBody(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
+		} else {
+			bbox |= l->PaintBody(spd, clip, pAlphaMask, p, org2, m_time, alpha);
+		}
+		p.y += l->m_ascent + l->m_descent;
+	}
+
+	return bbox;
+}
+
 STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox)
 {
 	std::unique_lock<std::mutex> lock(m_mutexRender);
@@ -3069,18 +3514,22 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 	}
 
 	// clear any cached subs that is behind current time
-	{
-		POSITION pos = m_subtitleCache.GetStartPosition();
-		while (pos) {
-			int entry;
-			CSubtitle* pSub;
-			m_subtitleCache.GetNextAssoc(pos, entry, pSub);
+	while (!m_subtitleCacheExpiry.empty() && m_subtitleCacheExpiry.top().first < time) {
+		const int entry = m_subtitleCacheExpiry.top().second;
+		m_subtitleCacheExpiry.pop();
 
-			STSEntry& stse = GetAt(entry);
-			if (stse.end < time) {
-				delete pSub;
-				m_subtitleCache.RemoveKey(entry);
-			}
+		CSubtitle* pSub;
+		if (!m_subtitleCache.Lookup(entry, pSub)) {
+			continue;
+		}
+
+		// the end time may have been changed since the sub was cached
+		const int end = GetAt(entry).end;
+		if (end < time) {
+			delete pSub;
+			m_subtitleCache.RemoveKey(entry);
+		} else {
+			m_subtitleCacheExpiry.emplace(end, entry);
 		}
 	}
 
@@ -3257,71 +3706,53 @@ STDMETHODIMP CRenderedTextSubtitle::Render(SubPicDesc& spd, REFERENCE_TIME rt, d
 			org2 = org;
 		}
 
-		CPoint p, p2(0, r.top);
-		p = p2;
+		if (!s->m_fAnimated && !s->m_bIsAnimated) {
+			CComposedSubtitle& composed = s->m_composed;
 
-		// Rectangles for inverse clip
-		CRect iclipRect[4];
-		iclipRect[0] = CRect(0, 0, spd.w, clipRect.top);
-		iclipRect[1] = CRect(0, clipRect.top, clipRect.left, clipRect.bottom);
-		iclipRect[2] = CRect(clipRect.right, clipRect.top, spd.w, clipRect.bottom);
-		iclipRect[3] = CRect(0, clipRect.bottom, spd.w, spd.h);
+			if (!composed.IsSame(r, clipRect, org2, alpha)) {
+				m_renderingCaches.composedImages.Free(composed);
+				composed.rect = r;
+				composed.clip = clipRect;
+				composed.org = org2;
+				composed.alpha = alpha;
+				composed.bbox = PaintSubtitle(spd, s, clipRect, CRect(0, 0, spd.w, spd.h), pAlphaMask, org, org2, r.top, alpha);
 
-		POSITION pos = s->GetHeadPosition();
-		while (pos) {
-			CLine* l = s->GetNext(pos);
-
-			p.x = (s->m_scrAlignment % 3) == 1 ? org.x
-				: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
-				:                                org.x - (l->m_width / 2);
-			if (s->m_clipInverse) {
-				bbox2 |= l->PaintShadow(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintShadow(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintShadow(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintShadow(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
-			} else {
-				bbox2 |= l->PaintShadow(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
+				bbox2 |= composed.bbox;
+				continue;
 			}
-			p.y += l->m_ascent + l->m_descent;
-		}
 
-		p = p2;
-		pos = s->GetHeadPosition();
-		while (pos) {
-			CLine* l = s->GetNext(pos);
-
-			p.x = (s->m_scrAlignment % 3) == 1 ? org.x
-				: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
-				:                                org.x - (l->m_width / 2);
-			if (s->m_clipInverse) {
-				bbox2 |= l->PaintOutline(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintOutline(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintOutline(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintOutline(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
-			} else {
-				bbox2 |= l->PaintOutline(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
+			if (composed.bbox.IsRectEmpty()) {
+				continue;
 			}
-			p.y += l->m_ascent + l->m_descent;
-		}
 
-		p = p2;
-		pos = s->GetHeadPosition();
-		while (pos) {
-			CLine* l = s->GetNext(pos);
-
-			p.x = (s->m_scrAlignment % 3) == 1 ? org.x
-				: (s->m_scrAlignment % 3) == 0 ? org.x - l->m_width
-				:                                org.x - (l->m_width / 2);
-			if (s->m_clipInverse) {
-				bbox2 |= l->PaintBody(spd, iclipRect[0], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintBody(spd, iclipRect[1], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintBody(spd, iclipRect[2], pAlphaMask, p, org2, m_time, alpha);
-				bbox2 |= l->PaintBody(spd, iclipRect[3], pAlphaMask, p, org2, m_time, alpha);
-			} else {
-				bbox2 |= l->PaintBody(spd, clipRect, pAlphaMask, p, org2, m_time, alpha);
+			// The image gives the same pixels as drawing the subtitle only over the clear subpicture,
+			// where it overlaps another subtitle it's drawn again.
+			if (composed.IsDrawnAsIs(spd)) {
+				if (composed.pos) {
+					m_renderingCaches.composedImages.Touch(composed);
+					composed.Draw(spd);
+					bbox2 |= composed.bbox;
+					continue;
+				}
+
+				if (m_renderingCaches.composedImages.Alloc(composed)) {
+					// Drawn again at the same place, keep the result for the next time.
+					// The image only covers the bbox, so the subpicture is shifted to start at its top left
+					// and the drawing is clipped to it.
+					SubPicDesc spdComposed = spd;
+					spdComposed.pitch = composed.bbox.Width() * 4;
+					spdComposed.bits = (BYTE*)composed.bits.data() - composed.bbox.top * spdComposed.pitch - composed.bbox.left * 4;
+
+					PaintSubtitle(spdComposed, s, clipRect, composed.bbox, pAlphaMask, org, org2, r.top, alpha);
+
+					composed.Draw(spd);
+					bbox2 |= composed.bbox;
+					continue;
+				}
 			}
-			p.y += l->m_ascent + l->m_descent;
 		}
+
+		bbox2 |= PaintSubtitle(spd, s, clipRect, CRect(0, 0, spd.w, spd.h), pAlphaMask, org, org2, r.top, alpha);
 	}
 
 	bbox = bbox2;
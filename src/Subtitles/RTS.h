@@ -22,10 +22,12 @@
 #pragma once
 
 #include <mutex>
+#include <queue>
 #include "STS.h"
 #include "Rasterizer.h"
 #include "SubPic/SubPicProviderImpl.h"
 #include "RenderingCache.h"
+#include "GlyphProvider.h"
 
 class Effect;
 struct CTextDims;
@@ -74,19 +76,97 @@ struct CAlphaMask final : std::unique_ptr<BYTE[]> {
 };
 
 typedef std::shared_ptr<CPolygonPath> CPolygonPathSharedPtr;
+
+// GDI outline of a single character, positioned at the origin
+struct CGlyphPath {
+	std::vector<BYTE> types;
+	std::vector<POINT> points;
+	int advance;
+};
+
+typedef std::shared_ptr<CGlyphPath> CGlyphPathSharedPtr;
 struct SSATag;
 typedef std::shared_ptr<CAtlList<SSATag>> SSATagsList;
 typedef std::shared_ptr<CAlphaMask> CAlphaMaskSharedPtr;
 
+struct COutlineSizeTraits {
+	static size_t GetSize(const COutlineDataSharedPtr& p) {
+		return p ? sizeof(COutlineData) + (p->mOutline.capacity() + p->mWideOutline.capacity()) * sizeof(tSpanBuffer::value_type) : 0;
+	}
+};
+
+struct COverlaySizeTraits {
+	static size_t GetSize(const COverlayDataSharedPtr& p) {
+		return p ? sizeof(COverlayData) + size_t(p->mOverlayPitch) * p->mOverlayHeight * 2 : 0;
+	}
+};
+
+struct CAlphaMaskSizeTraits {
+	static size_t GetSize(const CAlphaMaskSharedPtr& p) {
+		return p ? sizeof(CAlphaMask) + p->m_size : 0;
+	}
+};
+
 typedef CRenderingCache<CTextDimsKey, CTextDims, CKeyTraits<CTextDimsKey>> CTextDimsCache;
 typedef CRenderingCache<CPolygonPathKey, CPolygonPathSharedPtr, CKeyTraits<CPolygonPathKey>> CPolygonCache;
 typedef CRenderingCache<CStringW, SSATagsList, CStringElementTraits<CStringW>> CSSATagsCache;
 typedef CRenderingCache<CEllipseKey, CEllipseSharedPtr, CKeyTraits<CEllipseKey>> CEllipseCache;
-typedef CRenderingCache<COutlineKey, COutlineDataSharedPtr, CKeyTraits<COutlineKey>> COutlineCache;
-typedef CRenderingCache<COverlayKey, COverlayDataSharedPtr, CKeyTraits<COverlayKey>> COverlayCache;
-typedef CRenderingCache<CClipperKey, CAlphaMaskSharedPtr, CKeyTraits<CClipperKey>> CAlphaMaskCache;
+typedef CRenderingCache<CGlyphPathKey, CGlyphPathSharedPtr, CKeyTraits<CGlyphPathKey>> CGlyphPathCache;
+typedef CRenderingCache<COutlineKey, COutlineDataSharedPtr, CKeyTraits<COutlineKey>, CElementTraits<COutlineDataSharedPtr>, COutlineSizeTraits> COutlineCache;
+typedef CRenderingCache<COverlayKey, COverlayDataSharedPtr, CKeyTraits<COverlayKey>, CElementTraits<COverlayDataSharedPtr>, COverlaySizeTraits> COverlayCache;
+typedef CRenderingCache<CClipperKey, CAlphaMaskSharedPtr, CKeyTraits<CClipperKey>, CElementTraits<CAlphaMaskSharedPtr>, CAlphaMaskSizeTraits> CAlphaMaskCache;
+
+// Fully drawn image of a static subtitle and the placement it was drawn for.
+// The pixels are in the format of the subpicture, the alpha is the transparency.
+struct CComposedSubtitle {
+	CRect rect, clip;
+	CPoint org;
+	int alpha = -1;
+	CRect bbox;					// area covered by the subtitle, in pixels
+	std::vector<DWORD> bits;	// only made when the subtitle is drawn again at the same place
+	POSITION pos = nullptr;		// in the composed images while the bits are kept
+
+	bool IsSame(const CRect& r, const CRect& c, CPoint o, int a) const {
+		return alpha == a && rect == r && clip == c && org == o;
+	}
+
+	bool IsDrawnAsIs(const SubPicDesc& spd) const;
+	void Draw(SubPicDesc& spd) const;
+};
+
+// The images of the composed subtitles share the memory budget of the caches and are freed
+// the least recently drawn first. The most recent one may be being drawn and is never evicted.
+class CComposedImages : public CRenderingCacheBase
+{
+	CRenderingCacheBudget& m_budget;
+	CAtlList<CComposedSubtitle*> m_list; // the most recently drawn first
+	size_t m_bytes = 0;
+
+	unsigned __int64 m_hits = 0;
+	unsigned __int64 m_misses = 0;
+	unsigned __int64 m_evictions = 0;
+
+public:
+	CComposedImages(CRenderingCacheBudget& budget);
+	~CComposedImages();
+
+	bool Alloc(CComposedSubtitle& composed);
+	void Touch(CComposedSubtitle& composed);
+	void Free(CComposedSubtitle& composed);
+
+	size_t GetBytes() const override;
+	bool EvictOldest() override;
+
+	CRenderingCacheStats GetStats() const;
+	void ResetStats();
+};
+
+#define RENDERING_CACHE_BUDGET_DEF 128 // MB
 
 struct RenderingCaches {
+	// Shared by the outline, overlay and alpha mask caches and the composed images, must be declared before them
+	CRenderingCacheBudget memoryBudget;
+
 	CTextDimsCache textDimsCache;
 	CPolygonCache polygonCache;
 	CSSATagsCache SSATagsCache;
@@ -96,23 +176,46 @@ struct RenderingCaches {
 	// Be careful about the order alphaMaskCache need to be destroyed before alphaMaskPool.
 	std::list<CAlphaMask> alphaMaskPool;
 	CAlphaMaskCache alphaMaskCache;
-
+	CGlyphPathCache glyphPathCache;
+	CComposedImages composedImages;
+	// not a cache, shared by all the words of the subtitle the same way
+	RasterizerStats rasterizerStats;
+	// not a cache either, the font backend of the subtitle
+	std::unique_ptr<CGlyphProvider> glyphProvider;
+
+	// The caches holding rendered data are bounded by the memory budget rather than by their size
 	RenderingCaches()
 		: textDimsCache(2048)
 		, polygonCache(2048)
 		, SSATagsCache(2048)
 		, ellipseCache(64)
-		, outlineCache(128)
-		, overlayCache(128)
-	, alphaMaskCache(128) {}
-};
+		, outlineCache(4096, &memoryBudget)
+		, overlayCache(4096, &memoryBudget)
+		, alphaMaskCache(1024, &memoryBudget)
+		, glyphPathCache(8192)
+		, composedImages(memoryBudget)
+		, glyphProvider(std::make_unique<CGdiGlyphProvider>()) {
+		memoryBudget.maxBytes = RENDERING_CACHE_BUDGET_DEF * 1024 * 1024;
+	}
 
-class CMyFont : public CFont
-{
-public:
-	int m_ascent, m_descent;
+	enum {
+		TEXT_DIMS,
+		POLYGON,
+		SSA_TAGS,
+		ELLIPSE,
+		OUTLINE,
+		OVERLAY,
+		ALPHA_MASK,
+		GLYPH_PATH,
+		COMPOSED,
+		CACHE_COUNT
+	};
 
-	CMyFont(STSStyle& style);
+	void SetMemoryBudget(size_t maxBytes);
+	CRenderingCacheStats GetStats(int cache) const;
+	static LPCWSTR GetName(int cache);
+	void ResetStats();
+	void DumpStats(LPCWSTR name) const;
 };
 
 struct CTextDims {
@@ -166,6 +269,9 @@ public:
 
 class CText : public CWord
 {
+	bool CanUseGlyphPaths() const;
+	bool CreatePathFromGlyphs();
+
 protected:
 	virtual bool CreatePath();
 
@@ -349,14 +455,33 @@ enum SSATagCmd {
 	SSA_unknown
 };
 
-#define SSA_CMD_MIN_LENGTH 1
-#define SSA_CMD_MAX_LENGTH 5
+// Fixed capacity array for the numeric parameters of a tag, no heap allocation
+template<typename T, size_t N>
+class CSSATagParams
+{
+	T m_values[N];
+	size_t m_count = 0;
+
+public:
+	void Add(const T& value) {
+		ASSERT(m_count < N);
+		if (m_count < N) {
+			m_values[m_count++] = value;
+		}
+	}
+	size_t GetCount() const { return m_count; }
+	bool IsEmpty() const { return m_count == 0; }
+	void RemoveAll() { m_count = 0; }
+
+	T& operator[](size_t i) { ASSERT(i < m_count); return m_values[i]; }
+	const T& operator[](size_t i) const { ASSERT(i < m_count); return m_values[i]; }
+};
 
 struct SSATag {
 	SSATagCmd cmd;
 	CAtlArray<CStringW, CStringElementTraits<CStringW>> params;
-	CAtlArray<int> paramsInt;
-	CAtlArray<double> paramsReal;
+	CSSATagParams<int, 8> paramsInt;    // at most 7 for \fade
+	CSSATagParams<double, 4> paramsReal; // at most 4 for \move
 	SSATagsList subTagsList;
 
 	SSATag() : cmd(SSA_unknown) {};
@@ -364,12 +489,10 @@ struct SSATag {
 	SSATag(const SSATag& tag)
 		: cmd(tag.cmd)
 		, params()
-		, paramsInt()
-		, paramsReal()
+		, paramsInt(tag.paramsInt)
+		, paramsReal(tag.paramsReal)
 		, subTagsList(tag.subTagsList) {
 		params.Copy(tag.params);
-		paramsInt.Copy(tag.paramsInt);
-		paramsReal.Copy(tag.paramsReal);
 	}
 };
 
@@ -411,6 +534,8 @@ public:
 
 	double m_scalex, m_scaley;
 
+	CComposedSubtitle m_composed;
+
 public:
 	CSubtitle(RenderingCaches& renderingCaches);
 	virtual ~CSubtitle();
@@ -442,8 +567,10 @@ public:
 class __declspec(uuid("537DCACA-2812-4a4f-B2C6-1A34C17ADEB0"))
 	CRenderedTextSubtitle : public CSimpleTextSubtitle, public CSubPicProviderImpl, public ISubStream
 {
-	static CAtlMap<CStringW, SSATagCmd, CStringElementTraits<CStringW>> s_SSATagCmds;
 	CAtlMap<int, CSubtitle*> m_subtitleCache;
+	// end time and entry of the cached subtitles, the earliest end on top
+	std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> m_subtitleCacheExpiry;
+	void ClearSubtitleCache();
 
 	RenderingCaches m_renderingCaches;
 
@@ -474,6 +601,8 @@ class __declspec(uuid("537DCACA-2812-4a4f-B2C6-1A34C17ADEB0"))
 	double CalcAnimation(double dst, double src, bool fAnimate);
 
 	CSubtitle* GetSubtitle(int entry);
+	CRect PaintSubtitle(SubPicDesc& spd, CSubtitle* s, const CRect& clipRect, const CRect& bounds, BYTE* pAlphaMask,
+						CPoint org, CPoint org2, int top, int alpha);
 
 	bool m_bForced = false;
 
@@ -491,8 +620,12 @@ public:
 
 	// call to signal this RTS to ignore any of the styles and apply the given override style
 	void SetOverride(bool bOverride, const STSStyle& styleOverride) {
+		std::unique_lock<std::mutex> lock(m_mutexRender);
+
 		m_bOverrideStyle = bOverride;
 		m_styleOverride = styleOverride;
+		// the cached subtitles and their composed images were made with the previous style
+		ClearSubtitleCache();
 	}
 
 	void SetAlignment(bool bOverridePlacement, LONG lHorPos, LONG lVerPos) {
@@ -504,6 +637,14 @@ public:
 
 	const bool GetText(const REFERENCE_TIME rt, const double fps, CString& text);
 
+	// the rasterizer stages are only counted when built with RASTERIZER_STATS
+	RasterizerStats GetRasterizerStats();
+	CRenderingCacheStats GetRenderingCacheStats(int cache);
+	void ResetStats();
+	void DumpStats();
+
+	void SetRenderingCacheBudget(size_t maxBytes);
+
 public:
 	bool Init(CSize size, const CRect& vidrect); // will call Deinit()
 	void Deinit();
@@ -26,6 +26,37 @@
 #include "SubPic/ISubPic.h"
 #include "DSUtil/CPUInfo.h"
 
+//
+// RasterizerStats
+//
+
+LPCWSTR RasterizerStats::GetStageName(int stage)
+{
+	static const LPCWSTR names[STAGE_COUNT] = {
+		L"ScanConvert",
+		L"CreateWidenedRegion",
+		L"Rasterize",
+		L"Blur",
+		L"Draw",
+	};
+
+	return stage >= 0 && stage < STAGE_COUNT ? names[stage] : L"";
+}
+
+void RasterizerStats::Dump(LPCWSTR name) const
+{
+	DLog(L"Rasterizer stats for '%s':", name);
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		const Counter& c = stages[i];
+		DLog(L"    %-20s calls: %10I64u, bytes: %12I64u, ticks: %14I64u, ticks/call: %I64u",
+			 GetStageName(i), c.calls, c.bytes, c.ticks, c.calls ? c.ticks / c.calls : 0);
+	}
+}
+
+//
+// Rasterizer
+//
+
 int Rasterizer::getOverlayWidth() const
 {
 	return m_pOverlayData ? m_pOverlayData->mOverlayWidth * 8 : 0;
@@ -232,102 +263,43 @@ void Rasterizer::_EvaluateLine(int x0, int y0, int x1, int y1)
 	}
 }
 
-bool Rasterizer::BeginPath(HDC hdc)
-{
-	_TrashPath();
-
-	return !!::BeginPath(hdc);
-}
-
-bool Rasterizer::EndPath(HDC hdc)
-{
-	::CloseFigure(hdc);
-
-	if (::EndPath(hdc)) {
-		mPathPoints = GetPath(hdc, nullptr, nullptr, 0);
-
-		if (!mPathPoints) {
-			return true;
-		}
-
-		mpPathTypes = (BYTE*)malloc(sizeof(BYTE) * mPathPoints);
-		mpPathPoints = (POINT*)malloc(sizeof(POINT) * mPathPoints);
-
-		if (mPathPoints == GetPath(hdc, mpPathPoints, mpPathTypes, mPathPoints)) {
-			return true;
-		}
-	}
-
-	::AbortPath(hdc);
-
-	return false;
-}
-
-bool Rasterizer::PartialBeginPath(HDC hdc, bool bClearPath)
+bool Rasterizer::AppendPath(const BYTE* pTypes, const POINT* pPoints, int nPoints, long dx, long dy, bool bClearPath)
 {
 	if (bClearPath) {
 		_TrashPath();
 	}
 
-	return !!::BeginPath(hdc);
-}
-
-bool Rasterizer::PartialEndPath(HDC hdc, long dx, long dy)
-{
-	::CloseFigure(hdc);
-
-	if (::EndPath(hdc)) {
-		int nPoints;
-		BYTE* pNewTypes;
-		POINT* pNewPoints;
-
-		nPoints = GetPath(hdc, nullptr, nullptr, 0);
-
-		if (nPoints < 1) {
-			return true;
-		}
-
-		pNewTypes = (BYTE*)realloc(mpPathTypes, (mPathPoints + nPoints) * sizeof(BYTE));
-		pNewPoints = (POINT*)realloc(mpPathPoints, (mPathPoints + nPoints) * sizeof(POINT));
-
-		if (pNewTypes) {
-			mpPathTypes = pNewTypes;
-		}
-
-		if (pNewPoints) {
-			mpPathPoints = pNewPoints;
-		}
-
-		BYTE* pTypes = DNew BYTE[nPoints];
-		POINT* pPoints = DNew POINT[nPoints];
-
-		if (pNewTypes && pNewPoints && nPoints == GetPath(hdc, pPoints, pTypes, nPoints)) {
-			for (ptrdiff_t i = 0; i < nPoints; ++i) {
-				mpPathPoints[mPathPoints + i].x = pPoints[i].x + dx;
-				mpPathPoints[mPathPoints + i].y = pPoints[i].y + dy;
-				mpPathTypes[mPathPoints + i] = pTypes[i];
-			}
+	if (nPoints < 1) {
+		return true;
+	}
 
-			mPathPoints += nPoints;
+	BYTE* pNewTypes = (BYTE*)realloc(mpPathTypes, (mPathPoints + nPoints) * sizeof(BYTE));
+	if (!pNewTypes) {
+		return false;
+	}
+	mpPathTypes = pNewTypes;
 
-			delete[] pTypes;
-			delete[] pPoints;
-			return true;
-		} else {
-			DebugBreak();
-		}
+	POINT* pNewPoints = (POINT*)realloc(mpPathPoints, (mPathPoints + nPoints) * sizeof(POINT));
+	if (!pNewPoints) {
+		return false;
+	}
+	mpPathPoints = pNewPoints;
 
-		delete[] pTypes;
-		delete[] pPoints;
+	for (ptrdiff_t i = 0; i < nPoints; ++i) {
+		mpPathPoints[mPathPoints + i].x = pPoints[i].x + dx;
+		mpPathPoints[mPathPoints + i].y = pPoints[i].y + dy;
+		mpPathTypes[mPathPoints + i] = pTypes[i];
 	}
 
-	::AbortPath(hdc);
+	mPathPoints += nPoints;
 
-	return false;
+	return true;
 }
 
 bool Rasterizer::ScanConvert()
 {
+	RASTERIZER_STATS_SCOPE(statsScope, SCAN_CONVERT);
+
 	try {
 		int lastmoveto = INT_MAX;
 		int i;
@@ -519,6 +491,8 @@ bool Rasterizer::ScanConvert()
 		free(mpEdgeBuffer);
 		delete [] mpScanBuffer;
 
+		RASTERIZER_STATS_BYTES(statsScope, m_pOutlineData->mOutline.size() * sizeof(tSpanBuffer::value_type));
+
 		// All done!
 		return true;
 	} catch (CMemoryException* e) {
@@ -655,6 +629,8 @@ void Rasterizer::_OverlapRegion(tSpanBuffer& dst, const tSpanBuffer& src, int dx
 
 bool Rasterizer::CreateWidenedRegion(int rx, int ry)
 {
+	RASTERIZER_STATS_SCOPE(statsScope, WIDEN_REGION);
+
 	if (m_pOutlineData->mOutline.empty()) {
 		return true;
 	}
@@ -686,6 +662,8 @@ bool Rasterizer::CreateWidenedRegion(int rx, int ry)
 		_OverlapRegion(m_pOutlineData->mWideOutline, m_pOutlineData->mOutline, 0, 0);
 	}
 
+	RASTERIZER_STATS_BYTES(statsScope, m_pOutlineData->mWideOutline.size() * sizeof(tSpanBuffer::value_type));
+
 	return true;
 }
 
@@ -773,6 +751,8 @@ void Rasterizer::CreateWidenedRegionFast(const int ry)
 
 bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
 {
+	RASTERIZER_STATS_SCOPE(statsScope, RASTERIZE);
+
 	m_pOverlayData = std::make_shared<COverlayData>();
 
 	if (!m_pOutlineData || !m_pOutlineData->mWidth || !m_pOutlineData->mHeight) {
@@ -827,6 +807,8 @@ bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
 	ZeroMemory(m_pOverlayData->mpOverlayBufferBody, m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight);
 	ZeroMemory(m_pOverlayData->mpOverlayBufferBorder, m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight);
 
+	RASTERIZER_STATS_BYTES(statsScope, m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight * 2);
+
 	// Are we doing a border?
 
 	const tSpanBuffer* pOutline[2] = {&m_pOutlineData->mOutline, &m_pOutlineData->mWideOutline};
@@ -866,56 +848,61 @@ bool Rasterizer::Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur)
 		}
 	}
 
+	// Counts the blur passes, they run until the end of the function
+#if RASTERIZER_STATS
+	CRasterizerStatsScope blurScope((fGaussianBlur > 0 || fBlur) ? m_pStats : nullptr, RasterizerStats::BLUR);
+	blurScope.AddBytes(m_pOverlayData->mOverlayPitch * m_pOverlayData->mOverlayHeight * ((fGaussianBlur > 0) + fBlur));
+#endif
+
 	// Do some gaussian blur magic
 	if (fGaussianBlur > 0) {
 		GaussianKernel filter(fGaussianBlur);
 		if (m_pOverlayData->mOverlayWidth >= filter.width && m_pOverlayData->mOverlayHeight >= filter.width) {
 			size_t pitch = m_pOverlayData->mOverlayPitch;
 
-			byte *tmp = (byte*)_aligned_malloc(pitch * m_pOverlayData->mOverlayHeight * sizeof(byte), 16);
-			if (!tmp) {
-				return false;
-			}
-
 			byte* src = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
 
-			SeparableFilterX_SSE2(src, tmp, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-								  filter.kernel, filter.width, filter.divisor);
-			SeparableFilterY_SSE2(tmp, src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
-								  filter.kernel, filter.width, filter.divisor);
+			if (filter.width >= BOX_BLUR_MIN_KERNEL_WIDTH) {
+				// Large kernels are approximated by box blurs whose cost doesn't grow with the radius
+				BoxBlurKernel boxes(filter);
+				if (!BoxBlur(src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
+							 boxes.radius, (int)std::size(boxes.radius), m_bUseAVX2)) {
+					return false;
+				}
+			} else {
+				byte *tmp = (byte*)_aligned_malloc(pitch * m_pOverlayData->mOverlayHeight * sizeof(byte), 16);
+				if (!tmp) {
+					return false;
+				}
 
-			_aligned_free(tmp);
+				SeparableFilterX_SSE2(src, tmp, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
+									  filter.kernel, filter.width, filter.divisor);
+				SeparableFilterY_SSE2(tmp, src, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch,
+									  filter.kernel, filter.width, filter.divisor);
+
+				_aligned_free(tmp);
+			}
 		}
 	}
 
 	// If we're blurring, do a 3x3 box blur
 	// Can't do it on subpictures smaller than 3x3 pixels
-	for (int pass = 0; pass < fBlur; pass++) {
-		if (m_pOverlayData->mOverlayWidth >= 3 && m_pOverlayData->mOverlayHeight >= 3) {
-			int pitch = m_pOverlayData->mOverlayPitch;
+	if (fBlur && m_pOverlayData->mOverlayWidth >= 3 && m_pOverlayData->mOverlayHeight >= 3) {
+		size_t pitch = m_pOverlayData->mOverlayPitch;
 
-			byte* tmp = DNew byte[pitch * m_pOverlayData->mOverlayHeight];
-			if (!tmp) {
-				return false;
-			}
-
-			byte* buffer = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
-			memcpy(tmp, buffer, pitch * m_pOverlayData->mOverlayHeight);
-
-			// This could be done in a separated way and win some speed
-			for (ptrdiff_t j = 1; j < m_pOverlayData->mOverlayHeight-1; j++) {
-				byte* src = tmp + pitch*j + 1;
-				byte* dst = buffer + pitch * j + 1;
+		// Two rows of horizontal sums, shared by all passes
+		unsigned short* rows = (unsigned short*)_aligned_malloc(pitch * 2 * sizeof(unsigned short), 32);
+		if (!rows) {
+			return false;
+		}
 
-				for (ptrdiff_t i = 1; i < m_pOverlayData->mOverlayWidth-1; i++, src++, dst++) {
-					*dst = (src[-1-pitch] + (src[-pitch] << 1) + src[+1 - pitch]
-							+ (src[-1] << 1) + (src[0] << 2) + (src[+1] << 1)
-							+ src[-1 +pitch] + (src[+pitch] << 1) + src[+1 +pitch]) >> 4;
-				}
-			}
+		byte* buffer = m_pOutlineData->mWideOutline.empty() ? m_pOverlayData->mpOverlayBufferBody : m_pOverlayData->mpOverlayBufferBorder;
 
-			delete [] tmp;
+		for (int pass = 0; pass < fBlur; pass++) {
+			Blur3x3(buffer, m_pOverlayData->mOverlayWidth, m_pOverlayData->mOverlayHeight, pitch, rows, m_bUseAVX2);
 		}
+
+		_aligned_free(rows);
 	}
 
 	return true;
@@ -1700,6 +1687,8 @@ namespace
 CRect Rasterizer::Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int xsub, int ysub,
 					   const DWORD* switchpts, bool fBody, bool fBorder) const
 {
+	RASTERIZER_STATS_SCOPE(statsScope, DRAW);
+
 	CRect bbox(0, 0, 0, 0);
 
 	if (!m_pOverlayData || !switchpts || (!fBody && !fBorder)) {
@@ -1745,6 +1734,8 @@ CRect Rasterizer::Draw(SubPicDesc& spd, CRect& clipRect, byte* pAlphaMask, int x
 	bbox.SetRect(x, y, x+w, y+h);
 	bbox &= CRect(0, 0, spd.w, spd.h);
 
+	RASTERIZER_STATS_BYTES(statsScope, w * h * 4);
+
 	BYTE* srcBody = m_pOverlayData->mpOverlayBufferBody + m_pOverlayData->mOverlayPitch * yo + xo;
 	BYTE* srcBorder = m_pOverlayData->mpOverlayBufferBorder + m_pOverlayData->mOverlayPitch * yo + xo;
 	BYTE* alphaMask = pAlphaMask + spd.w * y + x;
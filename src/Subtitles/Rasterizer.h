@@ -28,8 +28,73 @@
 #define PT_BSPLINETO		0xfc
 #define PT_BSPLINEPATCHTO	0xfa
 
+// 1 - count the calls, produced bytes and TSC ticks of the rasterizer stages
+#define RASTERIZER_STATS 0
+
 struct SubPicDesc;
 
+struct RasterizerStats {
+	enum Stage {
+		SCAN_CONVERT,
+		WIDEN_REGION,
+		RASTERIZE,
+		BLUR, // included in RASTERIZE
+		DRAW,
+		STAGE_COUNT
+	};
+
+	struct Counter {
+		unsigned __int64 calls = 0;
+		unsigned __int64 bytes = 0;
+		unsigned __int64 ticks = 0;
+	};
+
+	Counter stages[STAGE_COUNT];
+
+	void Reset() {
+		*this = {};
+	}
+
+	static LPCWSTR GetStageName(int stage);
+	void Dump(LPCWSTR name) const;
+};
+
+#if RASTERIZER_STATS
+#include <intrin.h>
+
+class CRasterizerStatsScope
+{
+	RasterizerStats::Counter* m_pCounter = nullptr;
+	unsigned __int64 m_start = 0;
+
+public:
+	CRasterizerStatsScope(RasterizerStats* pStats, RasterizerStats::Stage stage) {
+		if (pStats) {
+			m_pCounter = &pStats->stages[stage];
+			m_pCounter->calls++;
+			m_start = __rdtsc();
+		}
+	}
+	~CRasterizerStatsScope() {
+		if (m_pCounter) {
+			m_pCounter->ticks += __rdtsc() - m_start;
+		}
+	}
+
+	void AddBytes(size_t bytes) {
+		if (m_pCounter) {
+			m_pCounter->bytes += bytes;
+		}
+	}
+};
+
+#define RASTERIZER_STATS_SCOPE(var, stage) CRasterizerStatsScope var(m_pStats, RasterizerStats::stage)
+#define RASTERIZER_STATS_BYTES(var, bytes) var.AddBytes(bytes)
+#else
+#define RASTERIZER_STATS_SCOPE(var, stage)
+#define RASTERIZER_STATS_BYTES(var, bytes)
+#endif
+
 
 using tSpanBuffer = std::vector<std::pair<unsigned __int64, unsigned __int64>>;
 
@@ -137,6 +202,7 @@ protected:
 	POINT* mpPathPoints;
 	int mPathPoints;
 	bool m_bUseAVX2;
+	RasterizerStats* m_pStats = nullptr; // not owned, see RASTERIZER_STATS
 
 private:
 	enum {
@@ -174,10 +240,7 @@ public:
 	Rasterizer();
 	virtual ~Rasterizer();
 
-	bool BeginPath(HDC hdc);
-	bool EndPath(HDC hdc);
-	bool PartialBeginPath(HDC hdc, bool bClearPath);
-	bool PartialEndPath(HDC hdc, long dx, long dy);
+	bool AppendPath(const BYTE* pTypes, const POINT* pPoints, int nPoints, long dx, long dy, bool bClearPath);
 	bool ScanConvert();
 	bool CreateWidenedRegion(int borderX, int borderY);
 	bool Rasterize(int xsub, int ysub, int fBlur, double fGaussianBlur);
@@ -76,6 +76,42 @@ bool CTextDimsKey::operator==(const CTextDimsKey& textDimsKey) const
 		   && m_style->fStrikeOut == textDimsKey.m_style->fStrikeOut;
 }
 
+CGlyphPathKey::CGlyphPathKey(WCHAR ch, const STSStyle& style)
+	: m_ch(ch)
+	, m_fontName(style.fontName)
+	, m_fontSize(style.fontSize)
+	, m_fontWeight(style.fontWeight)
+	, m_fItalic(style.fItalic)
+	, m_charSet(style.charSet)
+{
+	UpdateHash();
+}
+
+void CGlyphPathKey::UpdateHash()
+{
+	m_hash  = m_ch;
+	m_hash += m_hash << 5;
+	m_hash += m_charSet;
+	m_hash += m_hash << 5;
+	m_hash += CStringElementTraits<CString>::Hash(m_fontName);
+	m_hash += m_hash << 5;
+	m_hash += int(m_fontSize);
+	m_hash += m_hash << 5;
+	m_hash += m_fontWeight;
+	m_hash += m_hash << 5;
+	m_hash += m_fItalic;
+}
+
+bool CGlyphPathKey::operator==(const CGlyphPathKey& glyphPathKey) const
+{
+	return m_ch == glyphPathKey.m_ch
+		   && m_charSet == glyphPathKey.m_charSet
+		   && m_fontName == glyphPathKey.m_fontName
+		   && NEARLY_EQ(m_fontSize, glyphPathKey.m_fontSize, 1e-6)
+		   && m_fontWeight == glyphPathKey.m_fontWeight
+		   && m_fItalic == glyphPathKey.m_fItalic;
+}
+
 CPolygonPathKey::CPolygonPathKey(const CStringW& str, double scalex, double scaley)
 	: m_str(str)
 	, m_scalex(scalex)
@@ -21,20 +21,116 @@
 #pragma once
 
 #include <atlcoll.h>
+#include <algorithm>
+#include <vector>
 
-template<typename K, typename V, class KTraits = CElementTraits<K>, class VTraits = CElementTraits<V>>
-class CRenderingCache : private CAtlMap<K, POSITION, KTraits>
+// Size in bytes of a cached value, the caches using the default are only bounded by their number of entries
+template<typename V>
+struct CNoSizeTraits {
+	static size_t GetSize(const V&) { return 0; }
+};
+
+class CRenderingCacheBase
+{
+public:
+	virtual ~CRenderingCacheBase() = default;
+
+	virtual size_t GetBytes() const = 0;
+	virtual bool EvictOldest() = 0;
+};
+
+// Memory budget shared by several caches. When a new entry doesn't fit,
+// the oldest entries of the cache using the most memory are evicted first.
+struct CRenderingCacheBudget {
+	size_t maxBytes  = 0; // 0 - unlimited
+	size_t usedBytes = 0;
+	std::vector<CRenderingCacheBase*> caches;
+
+	bool IsOverBudget(size_t size) const {
+		return maxBytes && usedBytes + size > maxBytes;
+	}
+
+	bool EvictFromLargest() {
+		CRenderingCacheBase* pLargest = nullptr;
+		for (const auto& pCache : caches) {
+			if (pCache->GetBytes() && (!pLargest || pCache->GetBytes() > pLargest->GetBytes())) {
+				pLargest = pCache;
+			}
+		}
+
+		return pLargest && pLargest->EvictOldest();
+	}
+
+	void Shrink() {
+		while (IsOverBudget(0) && EvictFromLargest()) {
+		}
+	}
+};
+
+struct CRenderingCacheStats {
+	size_t count     = 0;
+	size_t maxCount  = 0;
+	size_t bytes     = 0;
+	unsigned __int64 hits      = 0;
+	unsigned __int64 misses    = 0;
+	unsigned __int64 evictions = 0;
+};
+
+template<typename K, typename V, class KTraits = CElementTraits<K>, class VTraits = CElementTraits<V>, class VSizeTraits = CNoSizeTraits<V>>
+class CRenderingCache : public CRenderingCacheBase, private CAtlMap<K, POSITION, KTraits>
 {
 private:
 	size_t m_maxSize;
+	CRenderingCacheBudget* m_pBudget;
 	struct CPositionValue {
 		POSITION pos;
 		V value;
+		size_t size;
 	};
 	CAtlList<CPositionValue> m_list;
 
+	size_t m_bytes = 0;
+	unsigned __int64 m_hits = 0;
+	unsigned __int64 m_misses = 0;
+	unsigned __int64 m_evictions = 0;
+
+	void AddBytes(size_t size) {
+		m_bytes += size;
+		if (m_pBudget) {
+			m_pBudget->usedBytes += size;
+		}
+	}
+
+	void RemoveBytes(size_t size) {
+		m_bytes -= size;
+		if (m_pBudget) {
+			m_pBudget->usedBytes -= size;
+		}
+	}
+
+	void RemoveTail() {
+		RemoveBytes(m_list.GetTail().size);
+		__super::RemoveAtPos(m_list.GetTail().pos);
+		m_list.RemoveTailNoReturn();
+		m_evictions++;
+	}
+
 public:
-	CRenderingCache(size_t maxSize) : m_maxSize(maxSize) {};
+	CRenderingCache(size_t maxSize, CRenderingCacheBudget* pBudget = nullptr)
+		: m_maxSize(maxSize)
+		, m_pBudget(pBudget) {
+		if (m_pBudget) {
+			m_pBudget->caches.push_back(this);
+		}
+	};
+
+	~CRenderingCache() {
+		Clear();
+		if (m_pBudget) {
+			auto& caches = m_pBudget->caches;
+			caches.erase(std::remove(caches.begin(), caches.end(), this), caches.end());
+		}
+	}
 
 	bool Lookup(typename KTraits::INARGTYPE key, _Out_ typename VTraits::OUTARGTYPE value) {
 		POSITION pos;
@@ -43,6 +139,9 @@ public:
 		if (bFound) {
 			m_list.MoveToHead(pos);
 			value = m_list.GetHead().value;
+			m_hits++;
+		} else {
+			m_misses++;
 		}
 
 		return bFound;
@@ -51,30 +150,67 @@ public:
 	POSITION SetAt(typename KTraits::INARGTYPE key, typename VTraits::INARGTYPE value) {
 		POSITION pos;
 		bool bFound = __super::Lookup(key, pos);
+		const size_t size = VSizeTraits::GetSize(value);
 
 		if (bFound) {
 			m_list.MoveToHead(pos);
 			CPositionValue& posVal = m_list.GetHead();
 			pos = posVal.pos;
 			posVal.value = value;
+			RemoveBytes(posVal.size);
+			// the entry has no size while evicting, so a cache holding only this entry isn't chosen
+			posVal.size = 0;
+			while (m_pBudget && m_pBudget->IsOverBudget(size) && m_pBudget->EvictFromLargest()) {
+			}
+			AddBytes(posVal.size = size);
 		} else {
-			if (m_list.GetCount() >= m_maxSize) {
-				__super::RemoveAtPos(m_list.GetTail().pos);
-				m_list.RemoveTailNoReturn();
+			while (!m_list.IsEmpty() && m_list.GetCount() >= m_maxSize) {
+				RemoveTail();
+			}
+			while (m_pBudget && m_pBudget->IsOverBudget(size) && m_pBudget->EvictFromLargest()) {
 			}
 			pos = __super::SetAt(key, m_list.AddHead());
 			CPositionValue& posVal = m_list.GetHead();
 			posVal.pos = pos;
 			posVal.value = value;
+			AddBytes(posVal.size = size);
 		}
 
 		return pos;
 	};
 
 	void Clear() {
+		RemoveBytes(m_bytes);
 		m_list.RemoveAll();
 		__super::RemoveAll();
 	}
+
+	size_t GetBytes() const override {
+		return m_bytes;
+	}
+
+	bool EvictOldest() override {
+		if (m_list.IsEmpty()) {
+			return false;
+		}
+		RemoveTail();
+		return true;
+	}
+
+	CRenderingCacheStats GetStats() const {
+		CRenderingCacheStats stats;
+		stats.count     = m_list.GetCount();
+		stats.maxCount  = m_maxSize;
+		stats.bytes     = m_bytes;
+		stats.hits      = m_hits;
+		stats.misses    = m_misses;
+		stats.evictions = m_evictions;
+		return stats;
+	}
+
+	void ResetStats() {
+		m_hits = m_misses = m_evictions = 0;
+	}
 };
 
 template <class Key>
@@ -112,6 +248,31 @@ public:
 	bool operator==(const CTextDimsKey& textDimsKey) const;
 };
 
+// One character of a font. The glyph path only depends on the font, the scaling
+// and the spacing of the style are applied to it afterwards.
+class CGlyphPathKey
+{
+private:
+	ULONG m_hash;
+
+protected:
+	WCHAR m_ch;
+	CString m_fontName;
+	double m_fontSize;
+	LONG m_fontWeight;
+	int m_fItalic;
+	int m_charSet;
+
+public:
+	CGlyphPathKey(WCHAR ch, const STSStyle& style);
+
+	ULONG GetHash() const { return m_hash; };
+
+	void UpdateHash();
+
+	bool operator==(const CGlyphPathKey& glyphPathKey) const;
+};
+
 class CPolygonPathKey
 {
 private:
@@ -2225,6 +2225,74 @@ const static OpenFunctStruct s_OpenFuncts[] = {
 	Subtitle::RT,   TIME,  OpenRealText,
 };
 
+// Scores the formats by the signatures found in the first lines of the file
+static void SniffFormats(CTextFile* f, int (&scores)[std::size(s_OpenFuncts)])
+{
+	auto AddScore = [&scores](STSOpenFunct open, int score) {
+		for (size_t i = 0; i < std::size(s_OpenFuncts); i++) {
+			if (s_OpenFuncts[i].open == open) {
+				scores[i] += score;
+			}
+		}
+	};
+
+	CStringW buff;
+	int chars = 0;
+	bool bFirstLine = true;
+	for (int line = 0; line < 64 && chars < 4096 && f->ReadString(buff); line++) {
+		chars += buff.GetLength();
+
+		FastTrim(buff);
+		if (buff.IsEmpty()) {
+			continue;
+		}
+
+		if (bFirstLine && buff.Left(6) == L"WEBVTT") {
+			AddScore(OpenVTT, 10);
+		}
+		bFirstLine = false;
+
+		int n[5];
+		if (buff[0] == L'[') {
+			if (buff.Find(L"[Script Info]") == 0 || buff.Find(L"[V4+ Styles]") == 0 || buff.Find(L"[V4 Styles]") == 0 || buff.Find(L"[Events]") == 0) {
+				AddScore(OpenSubStationAlpha, 10);
+			} else if (!_wcsnicmp(buff, L"[INFORMATION]", 13) || !_wcsnicmp(buff, L"[SUBTITLE]", 10)) {
+				AddScore(OpenSubViewer, 10);
+			} else if (swscanf_s(buff, L"[%d][%d]", &n[0], &n[1]) == 2) {
+				AddScore(OpenMPL2, 5);
+			} else if (swscanf_s(buff, L"[%d:%d", &n[0], &n[1]) == 2) {
+				AddScore(OpenLRC, 5);
+			}
+		} else if (buff[0] == L'{') {
+			if (swscanf_s(buff, L"{%d:%d:%d}{", &n[0], &n[1], &n[2]) == 3) {
+				AddScore(OpenOldSubRipper, 5);
+			} else if (swscanf_s(buff, L"{%d}{", &n[0]) == 1) {
+				AddScore(OpenMicroDVD, 5);
+			}
+		} else if (buff[0] == L'<') {
+			CStringW tag = buff.Left(32).MakeLower();
+			if (tag.Find(L"<sami") == 0) {
+				AddScore(OpenSami, 10);
+			} else if (tag.Find(L"<tt") == 0 || buff.Find(L"ttml") >= 0) {
+				AddScore(OpenTTML, 10);
+			} else if (tag.Find(L"<window") == 0) {
+				AddScore(OpenRealText, 10);
+			} else if (buff.Find(L"USFSubtitles") >= 0) {
+				AddScore(OpenUSF, 10);
+			}
+		} else if (buff.Find(L"Dialogue:") == 0) {
+			AddScore(OpenSubStationAlpha, 5);
+		} else if (buff.Find(L"-->") > 0) {
+			AddScore(OpenSubRipper, 5);
+			AddScore(OpenVTT, 3);
+		} else if (swscanf_s(buff, L"%d:%d:%d.%d,%d", &n[0], &n[1], &n[2], &n[3], &n[4]) == 5) {
+			AddScore(OpenSubViewer, 5);
+		} else if (swscanf_s(buff, L"%d:%d:%d:", &n[0], &n[1], &n[2]) == 3) {
+			AddScore(OpenVPlayer, 3);
+		}
+	}
+}
+
 //
 
 CSimpleTextSubtitle::CSimpleTextSubtitle()
@@ -2239,6 +2307,7 @@ CSimpleTextSubtitle::CSimpleTextSubtitle()
 	, m_dPARCompensation(1.0)
 	, m_subtitleType(Subtitle::SRT)
 	, m_fUsingAutoGeneratedDefaultStyle(false)
+	, m_bBulkLoad(false)
 {
 }
 
@@ -2350,6 +2419,7 @@ void CSimpleTextSubtitle::Empty()
 	m_dstScreenSize = CSize(0, 0);
 	m_styles.Free();
 	m_segments.RemoveAll();
+	m_bBulkLoad = false;
 	RemoveAll();
 }
 
@@ -2392,6 +2462,14 @@ void CSimpleTextSubtitle::Add(CStringW str, int start, int end, CString style, C
 	sub.end = end;
 	sub.readorder = readorder < 0 ? (int)GetCount() : readorder;
 
+	if (m_bBulkLoad) {
+		// The default growth of CAtlArray is capped at 1024 elements, grow geometrically instead
+		const size_t count = GetCount();
+		SetCount(count, std::max<size_t>(count, 1024));
+		__super::Add(sub);
+		return;
+	}
+
 	int n = (int)__super::Add(sub);
 
 	// Entries with a null duration don't belong to any segments since
@@ -2996,6 +3074,21 @@ static int BreakpointComp(const void* e1, const void* e2)
 	return (bp1->t - bp2->t);
 }
 
+void CSimpleTextSubtitle::BeginBulkLoad()
+{
+	m_bBulkLoad = true;
+}
+
+void CSimpleTextSubtitle::EndBulkLoad()
+{
+	if (m_bBulkLoad) {
+		m_bBulkLoad = false;
+		// back to the default growth for the entries added later one at a time
+		SetCount(GetCount(), 0);
+		CreateSegments();
+	}
+}
+
 void CSimpleTextSubtitle::CreateSegments()
 {
 	m_segments.RemoveAll();
@@ -3028,6 +3121,19 @@ void CSimpleTextSubtitle::CreateSegments()
 		}
 	}
 
+	// Keep the entries of a segment in read order like Add() does
+	auto ReadorderLess = [this](int a, int b) {
+		return GetAt(a).readorder < GetAt(b).readorder;
+	};
+	for (size_t i = 0, j = m_segments.GetCount(); i < j; i++) {
+		CAtlArray<int>& subs = m_segments[i].subs;
+		int* subsStart = subs.GetData();
+		int* subsEnd   = subsStart + subs.GetCount();
+		if (!std::is_sorted(subsStart, subsEnd, ReadorderLess)) {
+			std::stable_sort(subsStart, subsEnd, ReadorderLess);
+		}
+	}
+
 	OnChanged();
 	/*
 		for (size_t i = 0, j = m_segments.GetCount(); i < j; i++) {
@@ -3077,33 +3183,18 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, const CString& name)
 	const UINT charSet = CodePageToCharSet(f->GetEncoding());
 	ULONGLONG pos = f->GetPosition();
 
-	for (const auto& OpenFunct : s_OpenFuncts) {
-		if (!OpenFunct.open(f, *this)) {
-			if (!IsEmpty()) {
-				CString lastLine;
-				size_t n = CountLines(f, pos, f->GetPosition(), lastLine);
-				CString msg;
-				msg.Format(L"Unable to parse the subtitle file. Syntax error at line %Iu:\n\"%s\"", n + 1, lastLine);
-				AfxMessageBox(msg, MB_OK|MB_ICONERROR);
-				Empty();
-				break;
-			}
-
-			f->Seek(pos, CFile::begin);
-			Empty();
-			continue;
-		}
-
+	auto OnOpened = [&](const OpenFunctStruct& OpenFunct) {
 		m_name         = name;
 		m_subtitleType = OpenFunct.type;
 		m_mode         = OpenFunct.mode;
 		m_encoding     = f->GetEncoding();
 		m_path         = f->GetFilePath();
 
-		// No need to call Sort() or CreateSegments(), everything is done on the fly
+		// The entries are stored as they come, build the segments in one go
+		EndBulkLoad();
 
 		CWebTextFile f2(CP_UTF8);
-		if (f2.Open(f->GetFilePath() + L".style")) {
+		if (!m_path.IsEmpty() && f2.Open(m_path + L".style")) {
 			OpenSubStationAlpha(&f2, *this);
 			f2.Close();
 		}
@@ -3118,44 +3209,78 @@ bool CSimpleTextSubtitle::Open(CTextFile* f, const CString& name)
 
 		f->Close();
 		return true;
-	}
+	};
 
-	f->Close();
-	return false;
-}
+	// Try the formats recognized at the start of the file first, best match first
+	int scores[std::size(s_OpenFuncts)] = {};
+	SniffFormats(f, scores);
+	f->Seek(pos, CFile::begin);
 
-bool CSimpleTextSubtitle::Open(BYTE* data, int len, UINT codePage, CString name)
-{
-	WCHAR path[MAX_PATH];
-	if (!GetTempPathW(MAX_PATH, path)) {
-		return false;
+	size_t order[std::size(s_OpenFuncts)];
+	for (size_t i = 0; i < std::size(s_OpenFuncts); i++) {
+		order[i] = i;
 	}
+	std::stable_sort(std::begin(order), std::end(order), [&scores](size_t a, size_t b) {
+		return scores[a] > scores[b];
+	});
 
-	WCHAR fn[MAX_PATH];
-	if (!GetTempFileNameW(path, L"vs", 0, fn)) {
-		return false;
-	}
+	bool bRejected[std::size(s_OpenFuncts)] = {};
+	for (const size_t i : order) {
+		if (scores[i] <= 0) {
+			break;
+		}
 
-	FILE* tmp = nullptr;
-	if (_wfopen_s(&tmp, fn, L"wb") || !tmp) {
-		return false;
-	}
+		BeginBulkLoad();
+		if (s_OpenFuncts[i].open(f, *this)) {
+			return OnOpened(s_OpenFuncts[i]);
+		}
 
-	int i = 0;
-	for (; i <= (len-1024); i += 1024) {
-		fwrite(&data[i], 1024, 1, tmp);
+		// A parser that gave up on a partially parsed file is tried again below to report the error
+		bRejected[i] = IsEmpty();
+		f->Seek(pos, CFile::begin);
+		Empty();
 	}
-	if (len > i) {
-		fwrite(&data[i], len - i, 1, tmp);
+
+	for (size_t i = 0; i < std::size(s_OpenFuncts); i++) {
+		if (bRejected[i]) {
+			continue;
+		}
+
+		const auto& OpenFunct = s_OpenFuncts[i];
+		BeginBulkLoad();
+		if (!OpenFunct.open(f, *this)) {
+			if (!IsEmpty()) {
+				CString lastLine;
+				size_t n = CountLines(f, pos, f->GetPosition(), lastLine);
+				CString msg;
+				msg.Format(L"Unable to parse the subtitle file. Syntax error at line %Iu:\n\"%s\"", n + 1, lastLine);
+				AfxMessageBox(msg, MB_OK|MB_ICONERROR);
+				Empty();
+				break;
+			}
+
+			f->Seek(pos, CFile::begin);
+			Empty();
+			continue;
+		}
+
+		return OnOpened(OpenFunct);
 	}
 
-	fclose(tmp);
+	f->Close();
+	return false;
+}
 
-	bool fRet = Open(fn, codePage, false, name, {});
+bool CSimpleTextSubtitle::Open(BYTE* data, int len, UINT codePage, CString name)
+{
+	Empty();
 
-	_wremove(fn);
+	CTextFile f(CP_UTF8, codePage);
+	if (len <= 0 || !f.Open(data, (UINT)len)) {
+		return false;
+	}
 
-	return fRet;
+	return Open(&f, name);
 }
 
 bool CSimpleTextSubtitle::SaveAs(CString fn, Subtitle::SubType type, double fps, int delay, UINT e, bool bCreateExternalStyleFile)
@@ -3485,7 +3610,7 @@ STSStyle& STSStyle::operator = (LOGFONTW& lf)
 	return *this;
 }
 
-LOGFONTA& operator <<= (LOGFONTA& lfa, STSStyle& s)
+LOGFONTA& operator <<= (LOGFONTA& lfa, const STSStyle& s)
 {
 	lfa.lfCharSet = s.charSet;
 	strncpy_s(lfa.lfFaceName, LF_FACESIZE, CStringA(s.fontName), _TRUNCATE);
@@ -3499,7 +3624,7 @@ LOGFONTA& operator <<= (LOGFONTA& lfa, STSStyle& s)
 	return lfa;
 }
 
-LOGFONTW& operator <<= (LOGFONTW& lfw, STSStyle& s)
+LOGFONTW& operator <<= (LOGFONTW& lfw, const STSStyle& s)
 {
 	lfw.lfCharSet = s.charSet;
 	wcsncpy_s(lfw.lfFaceName, LF_FACESIZE, s.fontName, _TRUNCATE);
@@ -73,8 +73,8 @@ public:
 
 	STSStyle& operator = (LOGFONTW& lf);
 
-	friend LOGFONTA& operator <<= (LOGFONTA& lfa, STSStyle& s);
-	friend LOGFONTW& operator <<= (LOGFONTW& lfw, STSStyle& s);
+	friend LOGFONTA& operator <<= (LOGFONTA& lfa, const STSStyle& s);
+	friend LOGFONTW& operator <<= (LOGFONTW& lfw, const STSStyle& s);
 
 	friend CString& operator <<= (CString& style, const STSStyle& s);
 	friend STSStyle& operator <<= (STSStyle& s, const CString& style);
@@ -129,6 +129,7 @@ class CSimpleTextSubtitle : public CAtlArray<STSEntry>
 
 protected:
 	CAtlArray<STSSegment> m_segments;
+	bool m_bBulkLoad;
 	virtual void OnChanged() {}
 
 public:
@@ -170,6 +171,10 @@ public:
 	void Sort(bool fRestoreReadorder = false);
 	void CreateSegments();
 
+	// Add() only stores the entries until EndBulkLoad() builds all the segments at once
+	void BeginBulkLoad();
+	void EndBulkLoad();
+
 	void Append(CSimpleTextSubtitle& sts, int timeoff = -1);
 
 	bool Open(const CString& fn, UINT codePage, bool bAutoDetectCodePage, CString name, CString videoName);
@@ -366,3 +366,240 @@ struct GaussianKernel {
 		delete [] kernel;
 	}
 };
+
+// Kernels at least this wide are replaced by box blurs
+#define BOX_BLUR_MIN_KERNEL_WIDTH 17
+
+// Radii of a stack of box blurs with the same variance as the given kernel,
+// so switching between the two doesn't change the look of the blur
+struct BoxBlurKernel {
+	int radius[3];
+
+	inline BoxBlurKernel(const GaussianKernel& filter) {
+		const int c = filter.width / 2;
+		double variance = 0.0;
+		for (int i = 0; i < filter.width; i++) {
+			variance += filter.kernel[i] * double(i - c) * (i - c);
+		}
+		variance /= filter.divisor;
+
+		// A box of width w has a variance of (w*w - 1) / 12, use the nearest odd widths wl and wl + 2
+		const int n = (int)std::size(radius);
+		int wl = (int)sqrt(12.0 * variance / n + 1.0);
+		if (!(wl & 1)) {
+			wl--;
+		}
+		int m = (int)lround((12.0 * variance - n * wl * wl - 4 * n * wl - 3 * n) / (-4 * wl - 4));
+		m = std::clamp(m, 0, n);
+
+		for (int i = 0; i < n; i++) {
+			radius[i] = (i < m ? wl : wl + 2) / 2;
+		}
+	}
+};
+
+// Box blur of a line with zero outside of it, the cost doesn't depend on the radius
+static void BoxBlurLine(const float* src, float* dst, int width, int radius)
+{
+	const float scale = 1.0f / (2 * radius + 1);
+	float sum = 0.0f;
+
+	for (int x = 0; x < std::min(radius, width); x++) {
+		sum += src[x];
+	}
+	for (int x = 0; x < width; x++) {
+		if (x + radius < width) {
+			sum += src[x + radius];
+		}
+		dst[x] = sum * scale;
+		if (x >= radius) {
+			sum -= src[x - radius];
+		}
+	}
+}
+
+// Box blur in vertical direction, keeps a running sum for each column
+static void BoxBlurColumns(const float* src, float* dst, float* acc, int width, int height, ptrdiff_t stride, int radius, bool bUseAVX)
+{
+	const int width16 = (width + 15) & ~15;
+	const float scale = 1.0f / (2 * radius + 1);
+
+	ZeroMemory(acc, width16 * sizeof(float));
+	for (int y = 0; y < std::min(radius, height); y++) {
+		const float* in = src + y * stride;
+		for (int x = 0; x < width16; x++) {
+			acc[x] += in[x];
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		const float* add = (y + radius < height) ? src + (y + radius) * stride : nullptr;
+		const float* sub = (y >= radius) ? src + (y - radius) * stride : nullptr;
+		float* out = dst + y * stride;
+
+		if (bUseAVX) {
+			const __m256 coeff = _mm256_set1_ps(scale);
+			for (int x = 0; x < width16; x += 8) {
+				__m256 sum = _mm256_load_ps(&acc[x]);
+				if (add) {
+					sum = _mm256_add_ps(sum, _mm256_load_ps(&add[x]));
+				}
+				_mm256_store_ps(&out[x], _mm256_mul_ps(sum, coeff));
+				if (sub) {
+					sum = _mm256_sub_ps(sum, _mm256_load_ps(&sub[x]));
+				}
+				_mm256_store_ps(&acc[x], sum);
+			}
+		} else {
+			const __m128 coeff = _mm_set1_ps(scale);
+			for (int x = 0; x < width16; x += 4) {
+				__m128 sum = _mm_load_ps(&acc[x]);
+				if (add) {
+					sum = _mm_add_ps(sum, _mm_load_ps(&add[x]));
+				}
+				_mm_store_ps(&out[x], _mm_mul_ps(sum, coeff));
+				if (sub) {
+					sum = _mm_sub_ps(sum, _mm_load_ps(&sub[x]));
+				}
+				_mm_store_ps(&acc[x], sum);
+			}
+		}
+	}
+
+	if (bUseAVX) {
+		_mm256_zeroupper();
+	}
+}
+
+// Approximate a gaussian blur with a stack of box blurs, in place.
+// The stride must be a multiple of 16, the padding of the rows is cleared.
+bool BoxBlur(unsigned char* buf, int width, int height, ptrdiff_t stride, const int* radius, int passes, bool bUseAVX)
+{
+	const int width16 = (width + 15) & ~15;
+	float* img = (float*)_aligned_malloc(stride * height * sizeof(float), 32);
+	float* tmp = (float*)_aligned_malloc(stride * height * sizeof(float), 32);
+	float* line = (float*)_aligned_malloc(stride * 2 * sizeof(float), 32);
+	if (!img || !tmp || !line) {
+		_aligned_free(img);
+		_aligned_free(tmp);
+		_aligned_free(line);
+		return false;
+	}
+
+	for (int y = 0; y < height; y++) {
+		const unsigned char* in = buf + y * stride;
+		float* src = line;
+		float* dst = line + stride;
+
+		for (int x = 0; x < width; x++) {
+			src[x] = in[x];
+		}
+		for (int p = 0; p < passes; p++) {
+			BoxBlurLine(src, dst, width, radius[p]);
+			std::swap(src, dst);
+		}
+
+		float* out = img + y * stride;
+		memcpy(out, src, width * sizeof(float));
+		ZeroMemory(out + width, (width16 - width) * sizeof(float));
+	}
+
+	for (int p = 0; p < passes; p++) {
+		BoxBlurColumns(img, tmp, line, width, height, stride, radius[p], bUseAVX);
+		std::swap(img, tmp);
+	}
+
+	for (int y = 0; y < height; y++) {
+		const float* in = img + y * stride;
+		unsigned char* out = buf + y * stride;
+
+		for (int x = 0; x < width16; x += 16) {
+			// Round 16 values to 32-bit integers and pack them into 8-bit unsigned integers
+			__m128i accum1 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_load_ps(&in[x])), _mm_cvtps_epi32(_mm_load_ps(&in[x + 4])));
+			__m128i accum2 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_load_ps(&in[x + 8])), _mm_cvtps_epi32(_mm_load_ps(&in[x + 12])));
+			_mm_store_si128((__m128i*)&out[x], _mm_packus_epi16(accum1, accum2));
+		}
+	}
+
+	_aligned_free(img);
+	_aligned_free(tmp);
+	_aligned_free(line);
+
+	return true;
+}
+
+// 3x3 blur with the kernel [1 2 1] x [1 2 1] / 16, in place, the outermost pixels are kept.
+// rows is the scratch space for the horizontal sums of two rows, 2 * stride WORDs.
+void Blur3x3(unsigned char* buf, int width, int height, ptrdiff_t stride, unsigned short* rows, bool bUseAVX2)
+{
+	// Horizontal sums of the row above and the current row, taken before they were blurred
+	unsigned short* prev = rows;
+	unsigned short* cur = rows + stride;
+
+	for (int x = 1; x < width - 1; x++) {
+		prev[x] = buf[x - 1] + (buf[x] << 1) + buf[x + 1];
+		cur[x] = buf[stride + x - 1] + (buf[stride + x] << 1) + buf[stride + x + 1];
+	}
+
+	for (int y = 1; y < height - 1; y++) {
+		const unsigned char* in = buf + (y + 1) * stride;
+		unsigned char* out = buf + y * stride;
+		int x = 1;
+
+		if (bUseAVX2) {
+			for (; x + 32 <= width - 1; x += 32) {
+				// Horizontal sums of the next row, 16 pixels at a time
+				__m256i lo = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x - 1])),
+											  _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x + 1])));
+				lo = _mm256_add_epi16(lo, _mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x])), 1));
+				__m256i hi = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x + 15])),
+											  _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x + 17])));
+				hi = _mm256_add_epi16(hi, _mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*)&in[x + 16])), 1));
+
+				// Add the sums of the two rows above and divide by 16
+				__m256i sumLo = _mm256_add_epi16(_mm256_loadu_si256((__m256i*)&prev[x]), _mm256_slli_epi16(_mm256_loadu_si256((__m256i*)&cur[x]), 1));
+				sumLo = _mm256_srli_epi16(_mm256_add_epi16(sumLo, lo), 4);
+				__m256i sumHi = _mm256_add_epi16(_mm256_loadu_si256((__m256i*)&prev[x + 16]), _mm256_slli_epi16(_mm256_loadu_si256((__m256i*)&cur[x + 16]), 1));
+				sumHi = _mm256_srli_epi16(_mm256_add_epi16(sumHi, hi), 4);
+
+				_mm256_storeu_si256((__m256i*)&prev[x], lo);
+				_mm256_storeu_si256((__m256i*)&prev[x + 16], hi);
+				// packus works within 128-bit lanes, put the 64-bit blocks back in order
+				_mm256_storeu_si256((__m256i*)&out[x], _mm256_permute4x64_epi64(_mm256_packus_epi16(sumLo, sumHi), 0xD8));
+			}
+		}
+		for (; x + 16 <= width - 1; x += 16) {
+			const __m128i zero = _mm_setzero_si128();
+			__m128i left = _mm_loadu_si128((__m128i*)&in[x - 1]);
+			__m128i center = _mm_loadu_si128((__m128i*)&in[x]);
+			__m128i right = _mm_loadu_si128((__m128i*)&in[x + 1]);
+
+			// Horizontal sums of the next row
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(left, zero), _mm_unpacklo_epi8(right, zero));
+			lo = _mm_add_epi16(lo, _mm_slli_epi16(_mm_unpacklo_epi8(center, zero), 1));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(left, zero), _mm_unpackhi_epi8(right, zero));
+			hi = _mm_add_epi16(hi, _mm_slli_epi16(_mm_unpackhi_epi8(center, zero), 1));
+
+			// Add the sums of the two rows above and divide by 16
+			__m128i sumLo = _mm_add_epi16(_mm_loadu_si128((__m128i*)&prev[x]), _mm_slli_epi16(_mm_loadu_si128((__m128i*)&cur[x]), 1));
+			sumLo = _mm_srli_epi16(_mm_add_epi16(sumLo, lo), 4);
+			__m128i sumHi = _mm_add_epi16(_mm_loadu_si128((__m128i*)&prev[x + 8]), _mm_slli_epi16(_mm_loadu_si128((__m128i*)&cur[x + 8]), 1));
+			sumHi = _mm_srli_epi16(_mm_add_epi16(sumHi, hi), 4);
+
+			_mm_storeu_si128((__m128i*)&prev[x], lo);
+			_mm_storeu_si128((__m128i*)&prev[x + 8], hi);
+			_mm_storeu_si128((__m128i*)&out[x], _mm_packus_epi16(sumLo, sumHi));
+		}
+		for (; x < width - 1; x++) {
+			unsigned short next = in[x - 1] + (in[x] << 1) + in[x + 1];
+			out[x] = (unsigned char)((prev[x] + (cur[x] << 1) + next) >> 4);
+			prev[x] = next;
+		}
+
+		std::swap(prev, cur);
+	}
+
+	if (bUseAVX2) {
+		_mm256_zeroupper();
+	}
+}
@@ -21,6 +21,7 @@
 
 #include "stdafx.h"
 #include <afxinet.h>
+#include <intrin.h>
 #include "TextFile.h"
 #include <Utf8.h>
 #include "DSUtil/FileHandle.h"
@@ -88,12 +89,27 @@ bool CTextFile::Open(LPCWSTR lpszFileName)
 		return false;
 	}
 
+	return DetectEncoding();
+}
+
+bool CTextFile::Open(const BYTE* pData, UINT nSize)
+{
+	Close();
+
+	// CMemFile does not take the ownership of an attached buffer and we never write to it
+	m_pMemFile = std::make_unique<CMemFile>(const_cast<BYTE*>(pData), nSize);
+
+	return DetectEncoding();
+}
+
+bool CTextFile::DetectEncoding()
+{
 	m_offset = 0;
 	m_nInBuffer = m_posInBuffer = 0;
 
-	if (m_pStdioFile->GetLength() >= 4) {
+	if (GetFile()->GetLength() >= 4) {
 		uint8_t b[4] = {};
-		if (sizeof(b) != m_pStdioFile->Read(b, sizeof(b))) {
+		if (sizeof(b) != GetFile()->Read(b, sizeof(b))) {
 			Close();
 			return false;
 		}
@@ -147,13 +163,13 @@ bool CTextFile::Open(LPCWSTR lpszFileName)
 		}
 	}
 
-	if (m_encoding == CP_ASCII) {
+	if (m_encoding == CP_ASCII && m_pStdioFile) {
 		if (!ReopenAsText()) {
 			return false;
 		}
 	} else {
 		Seek(0, CStdioFile::begin);
-		m_posInFile = m_pStdioFile->GetPosition();
+		m_posInFile = GetFile()->GetPosition();
 	}
 
 	return true;
@@ -161,6 +177,11 @@ bool CTextFile::Open(LPCWSTR lpszFileName)
 
 bool CTextFile::ReopenAsText()
 {
+	if (m_pMemFile) {
+		// the encodings other than CP_ASCII are read from the binary data
+		return true;
+	}
+
 	auto fileName = m_strFileName;
 
 	Close();
@@ -204,6 +225,7 @@ void CTextFile::Close()
 		m_pFile.reset();
 		m_strFileName.Empty();
 	}
+	m_pMemFile.reset();
 }
 
 UINT CTextFile::GetEncoding() const
@@ -225,17 +247,17 @@ CStringW CTextFile::GetFilePath() const
 
 ULONGLONG CTextFile::GetPosition() const
 {
-	return m_pStdioFile ? (m_pStdioFile->GetPosition() - m_offset - (m_nInBuffer - m_posInBuffer)) : 0ULL;
+	return GetFile() ? (GetFile()->GetPosition() - m_offset - (m_nInBuffer - m_posInBuffer)) : 0ULL;
 }
 
 ULONGLONG CTextFile::GetLength() const
 {
-	return m_pStdioFile ? (m_pStdioFile->GetLength() - m_offset) : 0ULL;
+	return GetFile() ? (GetFile()->GetLength() - m_offset) : 0ULL;
 }
 
 ULONGLONG CTextFile::Seek(LONGLONG lOff, UINT nFrom)
 {
-	if (!m_pStdioFile) {
+	if (!GetFile()) {
 		return 0ULL;
 	}
 
@@ -264,7 +286,7 @@ ULONGLONG CTextFile::Seek(LONGLONG lOff, UINT nFrom)
 		if (m_posInBuffer < 0 || m_posInBuffer >= m_nInBuffer) {
 			// If we would have to end up out of the buffer, we just reset it and seek normally
 			m_nInBuffer = m_posInBuffer = 0;
-			newPos = m_pStdioFile->Seek(lOff + m_offset, CStdioFile::begin) - m_offset;
+			newPos = GetFile()->Seek(lOff + m_offset, CStdioFile::begin) - m_offset;
 		} else { // If we can reuse the buffer, we have nothing special to do
 			newPos = ULONGLONG(lOff);
 		}
@@ -272,7 +294,7 @@ ULONGLONG CTextFile::Seek(LONGLONG lOff, UINT nFrom)
 		if (nFrom == CStdioFile::begin) {
 			lOff += m_offset;
 		}
-		newPos = m_pStdioFile->Seek(lOff, nFrom) - m_offset;
+		newPos = GetFile()->Seek(lOff, nFrom) - m_offset;
 	}
 
 	m_posInFile = newPos + m_offset + (m_nInBuffer - m_posInBuffer);
@@ -346,7 +368,7 @@ void CTextFile::WriteString(LPCWSTR lpsz/*CStringW str*/)
 
 bool CTextFile::FillBuffer()
 {
-	if (!m_pStdioFile) {
+	if (!GetFile()) {
 		return false;
 	}
 
@@ -358,23 +380,23 @@ bool CTextFile::FillBuffer()
 	}
 	m_posInBuffer = 0;
 
-	UINT nBytesRead = m_pStdioFile->Read(&m_buffer[m_nInBuffer], UINT(TEXTFILE_BUFFER_SIZE - m_nInBuffer) * sizeof(char));
+	UINT nBytesRead = GetFile()->Read(&m_buffer[m_nInBuffer], UINT(TEXTFILE_BUFFER_SIZE - m_nInBuffer) * sizeof(char));
 	if (nBytesRead) {
 		m_nInBuffer += nBytesRead;
 	}
-	m_posInFile = m_pStdioFile->GetPosition();
+	m_posInFile = GetFile()->GetPosition();
 
 	return nBytesRead > 0;
 }
 
 ULONGLONG CTextFile::GetPositionFastBuffered() const
 {
-	return m_pStdioFile ? (m_posInFile - m_offset - (m_nInBuffer - m_posInBuffer)) : 0ULL;
+	return GetFile() ? (m_posInFile - m_offset - (m_nInBuffer - m_posInBuffer)) : 0ULL;
 }
 
 bool CTextFile::ReadString(CStringW& str)
 {
-	if (!m_pStdioFile) {
+	if (!GetFile()) {
 		return false;
 	}
 
@@ -382,7 +404,10 @@ bool CTextFile::ReadString(CStringW& str)
 
 	str.Truncate(0);
 
-	switch (m_encoding) {
+	// Memory files have no text mode, their CP_ASCII lines are decoded like the other code pages
+	const UINT encoding = (m_encoding == CP_ASCII && !m_pStdioFile) ? CP_ACP : m_encoding;
+
+	switch (encoding) {
 		case CP_ASCII: {
 				CStringW s;
 				fEOF = !m_pStdioFile->ReadString(s);
@@ -407,6 +432,56 @@ bool CTextFile::ReadString(CStringW& str)
 					int nCharsRead;
 
 					for (nCharsRead = 0; m_posInBuffer < m_nInBuffer; m_posInBuffer++, nCharsRead++) {
+						// Widen the runs of ASCII characters without line ends 16 bytes at a time.
+						// The output can't overtake the input, so the stores stay inside m_wbuffer.
+						while (m_posInBuffer + 16 <= m_nInBuffer) {
+							const __m128i bytes = _mm_loadu_si128((const __m128i*)&m_buffer[m_posInBuffer]);
+							const unsigned mask = _mm_movemask_epi8(bytes)
+												| _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')))
+												| _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r')));
+
+							_mm_storeu_si128((__m128i*)&m_wbuffer[nCharsRead], _mm_unpacklo_epi8(bytes, _mm_setzero_si128()));
+							_mm_storeu_si128((__m128i*)&m_wbuffer[nCharsRead + 8], _mm_unpackhi_epi8(bytes, _mm_setzero_si128()));
+
+							unsigned long n = 16;
+							if (mask) {
+								_BitScanForward(&n, mask);
+							}
+							m_posInBuffer += n;
+							nCharsRead += (int)n;
+
+							if (mask) {
+								break;
+							}
+						}
+						// Then the runs of 2 and 3 byte sequences, as in accented, cyrillic or CJK text,
+						// with one test of the lead and continuation bits per character. Overlong forms
+						// and anything else are left to the checks below.
+						while (m_posInBuffer + 4 <= m_nInBuffer) {
+							const uint32_t u = *(const uint32_t*)&m_buffer[m_posInBuffer];
+							uint32_t c;
+							int nBytes;
+
+							if ((u & 0xC0E0) == 0x80C0) { // 110xxxxx 10xxxxxx
+								c = (u & 0x1F) << 6 | (u >> 8 & 0x3F);
+								nBytes = 2;
+							} else if ((u & 0xC0C0F0) == 0x8080E0) { // 1110xxxx 10xxxxxx 10xxxxxx
+								c = (u & 0x0F) << 12 | (u >> 8 & 0x3F) << 6 | (u >> 16 & 0x3F);
+								nBytes = 3;
+							} else {
+								break;
+							}
+							if (c < 0x80) {
+								break;
+							}
+
+							m_wbuffer[nCharsRead++] = (wchar_t)c;
+							m_posInBuffer += nBytes;
+						}
+						if (m_posInBuffer >= m_nInBuffer) {
+							break;
+						}
+
 						if (Utf8::isSingleByte(m_buffer[m_posInBuffer])) { // 0xxxxxxx
 							m_wbuffer[nCharsRead] = m_buffer[m_posInBuffer] & 0x7f;
 						} else if (Utf8::isFirstOfMultibyte(m_buffer[m_posInBuffer])) {
@@ -55,15 +55,22 @@ private:
 
 	std::unique_ptr<FILE, std::integral_constant<decltype(&fclose), &fclose>> m_pFile;
 	std::unique_ptr<CStdioFile> m_pStdioFile;
+	std::unique_ptr<CMemFile> m_pMemFile;
 	CStringW m_strFileName;
 
 	bool OpenFile(LPCWSTR lpszFileName, LPCWSTR mode);
+	bool DetectEncoding();
+	CFile* GetFile() const {
+		return m_pStdioFile ? static_cast<CFile*>(m_pStdioFile.get()) : m_pMemFile.get();
+	}
 
 public:
 	CTextFile(UINT encoding = CP_ASCII, UINT defaultencoding = CP_ASCII, bool bAutoDetectCodePage = false);
 	virtual ~CTextFile();
 
 	bool Open(LPCWSTR lpszFileName);
+	// The data is read in place and must stay valid until Close()
+	bool Open(const BYTE* pData, UINT nSize);
 	bool Save(LPCWSTR lpszFileName, UINT e /*= ASCII*/);
 	void Close();
 
@@ -20,12 +20,14 @@
  */
 
 #include "stdafx.h"
+#include <intrin.h>
 #include <winioctl.h>
 #include "TextFile.h"
 #include "unrar.h"
 #include "VobSubFile.h"
 #include "RTS.h"
 #include "DSUtil/FileHandle.h"
+#include "DSUtil/CPUInfo.h"
 
 //
 
@@ -240,6 +242,8 @@ CVobSubFile::CVobSubFile(CCritSec* pLock)
 
 CVobSubFile::~CVobSubFile()
 {
+	StopPrefetch();
+	UnmapSub();
 }
 
 //
@@ -252,7 +256,10 @@ bool CVobSubFile::Copy(CVobSubFile& vsf)
 	m_title = vsf.m_title;
 	m_nLang = vsf.m_nLang;
 
-	m_sub.SetLength(vsf.m_sub.GetLength());
+	CFile& sub = vsf.GetSubData();
+	std::unique_lock<std::mutex> lock(vsf.m_mutexSub);
+
+	m_sub.SetLength(sub.GetLength());
 	m_sub.SeekToBegin();
 
 	for (size_t i = 0; i < std::size(m_langs); i++) {
@@ -269,14 +276,16 @@ bool CVobSubFile::Copy(CVobSubFile& vsf)
 				continue;
 			}
 
-			if (sp.filepos != (__int64)vsf.m_sub.Seek(sp.filepos, CFile::begin)) {
+			if (sp.filepos != (__int64)sub.Seek(sp.filepos, CFile::begin)) {
 				continue;
 			}
 
-			sp.filepos = m_sub.GetPosition();
-
 			BYTE buff[2048];
-			vsf.m_sub.Read(buff, 2048);
+			if (sub.Read(buff, 2048) != 2048 || GETU32(buff) != 0xba010000) {
+				continue;
+			}
+
+			sp.filepos = m_sub.GetPosition();
 			m_sub.Write(buff, 2048);
 
 			WORD packetsize = (buff[buff[0x16]+0x18]<<8) | buff[buff[0x16]+0x19];
@@ -288,7 +297,7 @@ bool CVobSubFile::Copy(CVobSubFile& vsf)
 				size = std::min(sizeleft, 2048 - hsize);
 
 				if (size != sizeleft) {
-					while (vsf.m_sub.Read(buff, 2048)) {
+					while (sub.Read(buff, 2048) && GETU32(buff) == 0xba010000) {
 						if (!(buff[0x15]&0x80) && buff[buff[0x16]+0x17] == (i|0x20)) {
 							break;
 						}
@@ -391,6 +400,8 @@ bool CVobSubFile::Save(CString fn, SubFormat sf)
 	if (!vsf.Copy(*this)) {
 		return false;
 	}
+	vsf.m_fnExportProgress = m_fnExportProgress;
+	vsf.m_nExportThreads = m_nExportThreads;
 
 	switch (sf) {
 		case VobSub:
@@ -410,8 +421,12 @@ bool CVobSubFile::Save(CString fn, SubFormat sf)
 
 void CVobSubFile::Close()
 {
+	StopPrefetch();
+	ClearDecodedImages();
+
 	InitSettings();
 	m_title.Empty();
+	UnmapSub();
 	m_sub.SetLength(0);
 	m_img.Invalidate();
 	m_nLang = -1;
@@ -756,28 +771,79 @@ bool CVobSubFile::ReadIdx(CString fn, int& ver)
 
 bool CVobSubFile::ReadSub(CString fn)
 {
-	CFile f;
-	if (!f.Open(fn, CFile::modeRead|CFile::typeBinary|CFile::shareDenyNone)) {
+	HANDLE hFile = CreateFileW(fn, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE) {
 		return false;
 	}
 
-	m_sub.SetLength(f.GetLength());
-	m_sub.SeekToBegin();
+	LARGE_INTEGER size = {};
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart > UINT_MAX) {
+		CloseHandle(hFile);
+		return false;
+	}
+	if (size.QuadPart == 0) {
+		CloseHandle(hFile);
+		return true;
+	}
 
-	int len;
-	BYTE buff[2048];
-	try {
-		while ((len = f.Read(buff, sizeof(buff))) > 0 && GETU32(buff) == 0xba010000) {
-			m_sub.Write(buff, len);
-		}
+	// The packs are read from a view of the file, only the pages in use are loaded.
+	// The readers stop at the first block that isn't a pack.
+	m_hSubMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(hFile);
+	if (!m_hSubMapping) {
+		return false;
+	}
+
+	BYTE* pView = (BYTE*)MapViewOfFile(m_hSubMapping, FILE_MAP_READ, 0, 0, 0);
+	if (!pView) {
+		UnmapSub();
+		return false;
 	}
-	catch (CFileException*) {
+
+	m_subView.Attach(pView, (UINT)size.QuadPart);
+
+	return true;
+}
+
+static bool CopyFromView(void* dst, const BYTE* src, size_t size)
+{
+	__try {
+		memcpy(dst, src, size);
+	} __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
 		return false;
 	}
 
 	return true;
 }
 
+UINT CVobSubFile::CSubView::Read(void* lpBuf, UINT nCount)
+{
+	if (m_nPosition >= m_nFileSize) {
+		return 0;
+	}
+
+	const UINT nRead = (UINT)std::min<SIZE_T>(nCount, m_nFileSize - m_nPosition);
+	if (!CopyFromView(lpBuf, m_lpBuffer + m_nPosition, nRead)) {
+		DLog(L"CVobSubFile::CSubView::Read() : I/O error at %Iu", m_nPosition);
+		return 0;
+	}
+	m_nPosition += nRead;
+
+	return nRead;
+}
+
+void CVobSubFile::UnmapSub()
+{
+	if (BYTE* pView = m_subView.Detach()) {
+		UnmapViewOfFile(pView);
+	}
+
+	if (m_hSubMapping) {
+		CloseHandle(m_hSubMapping);
+		m_hSubMapping = nullptr;
+	}
+}
+
 static unsigned char* RARbuff = nullptr;
 static unsigned int RARpos = 0;
 
@@ -1092,15 +1158,18 @@ bool CVobSubFile::WriteSub(CString fn)
 		return false;
 	}
 
-	if (m_sub.GetLength() == 0) {
+	CFile& sub = GetSubData();
+	std::unique_lock<std::mutex> lock(m_mutexSub);
+
+	if (sub.GetLength() == 0) {
 		return true;	// nothing to do...
 	}
 
-	m_sub.SeekToBegin();
+	sub.SeekToBegin();
 
 	int len;
 	BYTE buff[2048];
-	while ((len = m_sub.Read(buff, sizeof(buff))) > 0 && GETU32(buff) == 0xba010000) {
+	while ((len = sub.Read(buff, sizeof(buff))) > 0 && GETU32(buff) == 0xba010000) {
 		f.Write(buff, len);
 	}
 
@@ -1117,18 +1186,20 @@ BYTE* CVobSubFile::GetPacket(size_t idx, int& packetsize, int& datasize, int nLa
 		nLang = m_nLang;
 	}
 	std::vector<SubPos>& sp = m_langs[nLang].subpos;
+	CFile& sub = GetSubData();
+	std::unique_lock<std::mutex> lock(m_mutexSub);
 
 	do {
 		if (idx >= sp.size()) {
 			break;
 		}
 
-		if ((__int64)m_sub.Seek(sp[idx].filepos, CFile::begin) != sp[idx].filepos) {
+		if ((__int64)sub.Seek(sp[idx].filepos, CFile::begin) != sp[idx].filepos) {
 			break;
 		}
 
 		BYTE buff[0x800];
-		if (sizeof(buff) != m_sub.Read(buff, sizeof(buff))) {
+		if (sizeof(buff) != sub.Read(buff, sizeof(buff))) {
 			break;
 		}
 
@@ -1157,7 +1228,7 @@ BYTE* CVobSubFile::GetPacket(size_t idx, int& packetsize, int& datasize, int nLa
 			memcpy(&ret[i], &buff[hsize], size);
 
 			if (size != sizeleft) {
-				while (m_sub.Read(buff, sizeof(buff))) {
+				while (sub.Read(buff, sizeof(buff)) && GETU32(buff) == 0xba010000) {
 					if (/*!(buff[0x15] & 0x80) &&*/ buff[buff[0x16] + 0x17] == (nLang|0x20)) {
 						break;
 					}
@@ -1202,30 +1273,211 @@ bool CVobSubFile::GetFrame(size_t idx, int iLang /*= -1*/, REFERENCE_TIME rt /*=
 
 	if (m_img.nLang != iLang || m_img.nIdx != idx
 			|| (sp[idx].bAnimated && sp[idx].start + m_img.tCurrent <= rt)) {
-		int packetsize = 0, datasize = 0;
-		std::unique_ptr<BYTE[]> buff(GetPacket(idx, packetsize, datasize, iLang));
-		if (!buff || packetsize <= 0 || datasize <= 0) {
-			return false;
-		}
+		const DecodedPalette palette = GetDecodedPalette();
+		std::shared_ptr<DecodedImage> pImage = sp[idx].bAnimated ? nullptr : FindDecodedImage(iLang, idx, palette);
+
+		if (pImage) {
+			m_img.rect = pImage->rect;
+			m_img.lpPixels = pImage->pixels.data();
+			m_img.bForced = pImage->bForced;
+			m_img.bAnimated = false;
+			memcpy(m_img.pal, pImage->pal, sizeof(m_img.pal));
+			m_img.bCustomPal = m_bCustomPal;
+			m_img.tridx = m_tridx;
+			m_img.orgpal = m_orgpal;
+			m_img.cuspal = m_cuspal;
+			m_img.start = sp[idx].start;
+			m_img.delay = sp[idx].stop - sp[idx].start;
+			m_pCurImage = pImage;
+		} else {
+			int packetsize = 0, datasize = 0;
+			std::unique_ptr<BYTE[]> buff(GetPacket(idx, packetsize, datasize, iLang));
+			if (!buff || packetsize <= 0 || datasize <= 0) {
+				return false;
+			}
 
-		m_img.start = sp[idx].start;
+			m_img.start = sp[idx].start;
 
-		bool ret = m_img.Decode(buff.get(), packetsize, datasize, rt >= 0 ? int(rt - sp[idx].start) : INT_MAX,
-								m_bCustomPal, m_tridx, m_orgpal, m_cuspal, true);
+			bool ret = m_img.Decode(buff.get(), packetsize, datasize, rt >= 0 ? int(rt - sp[idx].start) : INT_MAX,
+									m_bCustomPal, m_tridx, m_orgpal, m_cuspal, true);
 
-		m_img.delay = sp[idx].stop - sp[idx].start;
+			m_img.delay = sp[idx].stop - sp[idx].start;
+			m_pCurImage.reset();
 
-		if (!ret) {
-			return false;
+			if (!ret) {
+				return false;
+			}
+
+			if (!sp[idx].bAnimated) {
+				AddDecodedImage(m_img, iLang, idx, palette);
+			}
 		}
 
 		m_img.nIdx = idx;
 		m_img.nLang = iLang;
+
+		RequestPrefetch(iLang, idx + 1);
 	}
 
 	return (m_bOnlyShowForcedSubs ? m_img.bForced : true);
 }
 
+CVobSubFile::DecodedPalette CVobSubFile::GetDecodedPalette() const
+{
+	DecodedPalette palette;
+	palette.bCustomPal = m_bCustomPal;
+	palette.tridx = m_tridx;
+	memcpy(palette.cuspal, m_cuspal, sizeof(palette.cuspal));
+
+	return palette;
+}
+
+std::shared_ptr<CVobSubFile::DecodedImage> CVobSubFile::FindDecodedImage(int nLang, size_t idx, const DecodedPalette& palette)
+{
+	std::unique_lock<std::mutex> lock(m_mutexDecoded);
+
+	for (auto it = m_decodedImages.begin(); it != m_decodedImages.end(); ++it) {
+		if ((*it)->nLang == nLang && (*it)->nIdx == idx && (*it)->palette == palette) {
+			m_decodedImages.splice(m_decodedImages.begin(), m_decodedImages, it);
+			return m_decodedImages.front();
+		}
+	}
+
+	return nullptr;
+}
+
+void CVobSubFile::AddDecodedImage(const CVobSubImage& img, int nLang, size_t idx, const DecodedPalette& palette)
+{
+	auto pImage = std::make_shared<DecodedImage>();
+	pImage->nLang = nLang;
+	pImage->nIdx = idx;
+	pImage->palette = palette;
+	pImage->rect = img.rect;
+	pImage->bForced = img.bForced;
+	memcpy(pImage->pal, img.pal, sizeof(pImage->pal));
+	pImage->pixels.assign(img.lpPixels, img.lpPixels + img.rect.Width() * img.rect.Height());
+
+	const size_t size = pImage->pixels.size() * sizeof(RGBQUAD);
+
+	std::unique_lock<std::mutex> lock(m_mutexDecoded);
+
+	for (const auto& pDecoded : m_decodedImages) {
+		if (pDecoded->nLang == nLang && pDecoded->nIdx == idx && pDecoded->palette == palette) {
+			return;
+		}
+	}
+
+	m_decodedImages.push_front(pImage);
+	m_decodedBytes += size;
+
+	// the image shown by m_img is kept alive by m_pCurImage
+	while (m_decodedBytes > MAX_DECODED_BYTES && m_decodedImages.size() > 1) {
+		m_decodedBytes -= m_decodedImages.back()->pixels.size() * sizeof(RGBQUAD);
+		m_decodedImages.pop_back();
+	}
+}
+
+void CVobSubFile::ClearDecodedImages()
+{
+	std::unique_lock<std::mutex> lock(m_mutexDecoded);
+
+	m_decodedImages.clear();
+	m_decodedBytes = 0;
+	m_pCurImage.reset();
+	m_img.Invalidate();
+}
+
+void CVobSubFile::RequestPrefetch(int nLang, size_t idx)
+{
+	if (m_nPrefetchImages <= 0) {
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutexDecoded);
+		m_nPrefetchLang = nLang;
+		m_nPrefetchIdx = idx;
+		m_prefetchPalette = GetDecodedPalette();
+		m_bPrefetchRequest = true;
+	}
+
+	if (!m_prefetchThread.joinable()) {
+		m_prefetchThread = std::thread([this] { PrefetchImages(); });
+	}
+	m_condPrefetch.notify_one();
+}
+
+void CVobSubFile::StopPrefetch()
+{
+	if (!m_prefetchThread.joinable()) {
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutexDecoded);
+		m_bExitPrefetch = true;
+	}
+	m_condPrefetch.notify_one();
+	m_prefetchThread.join();
+
+	m_bExitPrefetch = m_bPrefetchRequest = false;
+}
+
+void CVobSubFile::PrefetchImages()
+{
+	CVobSubImage img;
+
+	for (;;) {
+		int nLang;
+		size_t idx;
+		DecodedPalette palette;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutexDecoded);
+			m_condPrefetch.wait(lock, [this] { return m_bExitPrefetch || m_bPrefetchRequest; });
+			if (m_bExitPrefetch) {
+				break;
+			}
+
+			nLang = m_nPrefetchLang;
+			idx = m_nPrefetchIdx;
+			palette = m_prefetchPalette;
+			m_bPrefetchRequest = false;
+		}
+
+		// m_langs only changes after StopPrefetch
+		const std::vector<SubPos>& sp = m_langs[nLang].subpos;
+
+		// the palettes are copied, the settings can be changed while decoding
+		RGBQUAD orgpal[16], cuspal[4];
+		memcpy(orgpal, m_orgpal, sizeof(orgpal));
+		memcpy(cuspal, palette.cuspal, sizeof(cuspal));
+
+		for (int i = 0; i < m_nPrefetchImages && idx < sp.size(); i++, idx++) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutexDecoded);
+				if (m_bExitPrefetch || m_bPrefetchRequest) {
+					break;
+				}
+			}
+
+			if (!sp[idx].bValid || sp[idx].bAnimated || FindDecodedImage(nLang, idx, palette)) {
+				continue;
+			}
+
+			int packetsize = 0, datasize = 0;
+			std::unique_ptr<BYTE[]> buff(GetPacket(idx, packetsize, datasize, nLang));
+			if (!buff || packetsize <= 0 || datasize <= 0) {
+				continue;
+			}
+
+			if (img.Decode(buff.get(), packetsize, datasize, INT_MAX, palette.bCustomPal, palette.tridx, orgpal, cuspal, true)) {
+				AddDecodedImage(img, nLang, idx, palette);
+			}
+		}
+	}
+}
+
 bool CVobSubFile::GetFrameByTimeStamp(__int64 time)
 {
 	return GetFrame(GetFrameIdxByTimeStamp(time));
@@ -1454,39 +1706,156 @@ STDMETHODIMP CVobSubFile::Reload()
 
 // StretchBlt
 
-static void PixelAtBiLinear(RGBQUAD& c, int x, int y, CVobSubImage& src)
+// Each destination pixel is the average of two bilinear samples half a step apart in each
+// direction, so it reads four source positions per direction.
+struct StretchTaps {
+	int pos[4];    // two source positions for each sample
+	int weight[4]; // their 16.16 weights
+};
+
+static void CalcStretchTaps(std::vector<StretchTaps>& taps, int count, int pos, int step, int size)
+{
+	taps.resize(count);
+
+	for (int i = 0; i < count; i++, pos += step << 1) {
+		for (int k = 0; k < 2; k++) {
+			const int p = pos + k * step;
+			const int p1 = std::min(p >> 16, size - 1);
+			const int u = p & 0xffff;
+
+			taps[i].pos[k * 2] = p1;
+			taps[i].pos[k * 2 + 1] = std::min(p1 + 1, size - 1);
+			taps[i].weight[k * 2] = 0x10000 - u;
+			taps[i].weight[k * 2 + 1] = u;
+		}
+	}
+}
+
+// Same integer math as the original per-sample bilinear filter, so the output doesn't change.
+// The weights of a sample are truncated separately for each source pixel,
+// the colors to 8 bits once per sample and the sum of the four samples once again.
+static DWORD StretchPixel(const RGBQUAD* src, const StretchTaps& tx, const int* rows, const int* wy)
+{
+	unsigned b = 0, g = 0, r = 0, alpha = 0;
+
+	for (int sy = 0; sy < 4; sy += 2) {
+		for (int sx = 0; sx < 4; sx += 2) {
+			// one bilinear sample from 2x2 source pixels
+			unsigned sb = 0, sg = 0, sr = 0, sa = 0;
+			for (int j = sy; j < sy + 2; j++) {
+				for (int i = sx; i < sx + 2; i++) {
+					const RGBQUAD& c = src[rows[j] + tx.pos[i]];
+					const unsigned w = (unsigned)((__int64)wy[j] * tx.weight[i] >> 16) * c.rgbReserved;
+					sb += c.rgbBlue * w;
+					sg += c.rgbGreen * w;
+					sr += c.rgbRed * w;
+					sa += w;
+				}
+			}
+			b += sb >> 24;
+			g += sg >> 24;
+			r += sr >> 24;
+			alpha += sa >> 16;
+		}
+	}
+
+	b >>= 2;
+	g >>= 2;
+	r >>= 2;
+	alpha >>= 2;
+
+	return ((~alpha & 0xff) << 24) | ((r * alpha >> 8) << 16) | ((g * alpha >> 8) << 8) | (b * alpha >> 8);
+}
+
+// SSE4.1 version of StretchPixel, colors holds the source pixels as (B, G, R, 256)
+// so that the weights are summed together with the colors.
+static __forceinline DWORD StretchPixelSSE41(const RGBQUAD* src, const __m128i* colors, const StretchTaps& tx, const int* rows, const __m128i* wy)
 {
-	int w = src.rect.Width(),
-		h = src.rect.Height();
+	const __m128i txw = _mm_loadu_si128((const __m128i*)tx.weight);
+	const __m128i txw_odd = _mm_srli_epi64(txw, 32);
+
+	__m128i sum[4] = {};
+	__m128i alphas = _mm_setzero_si128();
 
-	int x1 = (x >> 16),
-		y1 = (y >> 16) * w,
-		x2 = std::min(x1 + 1, w - 1),
-		y2 = std::min(y1 + w, (h - 1) * w);
+	for (int j = 0; j < 4; j++) {
+		const int* row = (const int*)src + rows[j];
+		const __m128i a = _mm_srli_epi32(_mm_setr_epi32(row[tx.pos[0]], row[tx.pos[1]], row[tx.pos[2]], row[tx.pos[3]]), 24);
+		alphas = _mm_or_si128(alphas, a);
 
-	RGBQUAD* ptr = src.lpPixels;
+		// (v * u >> 16) * alpha for the four horizontal taps, the product can reach 2^32
+		const __m128i even = _mm_srli_epi64(_mm_mul_epu32(txw, wy[j]), 16);
+		const __m128i odd = _mm_slli_epi64(_mm_srli_epi64(_mm_mul_epu32(txw_odd, wy[j]), 16), 32);
+		const __m128i w = _mm_mullo_epi32(_mm_blend_epi16(even, odd, 0xcc), a);
 
-	RGBQUAD c11 = ptr[y1 + x1],	c12 = ptr[y1 + x2],
-			c21 = ptr[y2 + x1],	c22 = ptr[y2 + x2];
+		const __m128i* c = colors + rows[j];
+		sum[(j & 2) | 0] = _mm_add_epi32(sum[(j & 2) | 0], _mm_add_epi32(
+							   _mm_mullo_epi32(c[tx.pos[0]], _mm_shuffle_epi32(w, _MM_SHUFFLE(0, 0, 0, 0))),
+							   _mm_mullo_epi32(c[tx.pos[1]], _mm_shuffle_epi32(w, _MM_SHUFFLE(1, 1, 1, 1)))));
+		sum[(j & 2) | 1] = _mm_add_epi32(sum[(j & 2) | 1], _mm_add_epi32(
+							   _mm_mullo_epi32(c[tx.pos[2]], _mm_shuffle_epi32(w, _MM_SHUFFLE(2, 2, 2, 2))),
+							   _mm_mullo_epi32(c[tx.pos[3]], _mm_shuffle_epi32(w, _MM_SHUFFLE(3, 3, 3, 3)))));
+	}
+
+	if (_mm_testz_si128(alphas, alphas)) {
+		return 0xff000000;
+	}
 
-	__int64 u2 = x & 0xffff,
-			v2 = y & 0xffff,
-			u1 = 0x10000 - u2,
-			v1 = 0x10000 - v2;
+	__m128i bgra = _mm_add_epi32(_mm_add_epi32(_mm_srli_epi32(sum[0], 24), _mm_srli_epi32(sum[1], 24)),
+								 _mm_add_epi32(_mm_srli_epi32(sum[2], 24), _mm_srli_epi32(sum[3], 24)));
+	bgra = _mm_srli_epi32(bgra, 2);
 
-	int v1u1 = int(v1*u1 >> 16) * c11.rgbReserved,
-		v1u2 = int(v1*u2 >> 16) * c12.rgbReserved,
-		v2u1 = int(v2*u1 >> 16) * c21.rgbReserved,
-		v2u2 = int(v2*u2 >> 16) * c22.rgbReserved;
+	const __m128i alpha = _mm_shuffle_epi32(bgra, _MM_SHUFFLE(3, 3, 3, 3));
+	bgra = _mm_srli_epi32(_mm_mullo_epi32(bgra, alpha), 8);
+	bgra = _mm_blend_epi16(bgra, _mm_xor_si128(alpha, _mm_set1_epi32(0xff)), 0xc0);
+	bgra = _mm_packus_epi32(bgra, bgra);
 
-	c.rgbRed = (c11.rgbRed * v1u1 + c12.rgbRed * v1u2
-				+ c21.rgbRed * v2u1 + c22.rgbRed * v2u2) >> 24;
-	c.rgbGreen = (c11.rgbGreen * v1u1 + c12.rgbGreen * v1u2
-				  + c21.rgbGreen * v2u1 + c22.rgbGreen * v2u2) >> 24;
-	c.rgbBlue = (c11.rgbBlue * v1u1 + c12.rgbBlue * v1u2
-				 + c21.rgbBlue * v2u1 + c22.rgbBlue * v2u2) >> 24;
-	c.rgbReserved = (v1u1 + v1u2
-					 + v2u1 + v2u2) >> 16;
+	return (DWORD)_mm_cvtsi128_si32(_mm_packus_epi16(bgra, bgra));
+}
+
+template <bool bSSE41>
+static void StretchRows(SubPicDesc& spd, const CRect& dstrect, CVobSubImage& src, const std::vector<StretchTaps>& tapsX, const std::vector<StretchTaps>& tapsY)
+{
+	const int sw = src.rect.Width();
+	const int sh = src.rect.Height();
+
+	// The source colors with 256 in place of the alpha, so the alpha is summed with the colors
+	__m128i* colors = nullptr;
+	if (bSSE41) {
+		colors = (__m128i*)_aligned_malloc(sizeof(__m128i) * sw * sh, 16);
+		if (!colors) {
+			return;
+		}
+
+		const __m128i zero = _mm_setzero_si128();
+		for (int i = 0, n = sw * sh; i < n; i++) {
+			__m128i c = _mm_cvtsi32_si128(*(int*)&src.lpPixels[i]);
+			c = _mm_unpacklo_epi16(_mm_unpacklo_epi8(c, zero), zero);
+			colors[i] = _mm_insert_epi32(c, 256, 3);
+		}
+	}
+
+	for (int y = 0; y < dstrect.Height(); y++) {
+		const StretchTaps& ty = tapsY[y];
+		const int rows[4] = {ty.pos[0] * sw, ty.pos[1] * sw, ty.pos[2] * sw, ty.pos[3] * sw};
+
+		DWORD* ptr = (DWORD*)&(spd.bits)[(dstrect.top + y) * spd.pitch] + dstrect.left;
+
+		if (bSSE41) {
+			const __m128i wy[4] = {
+				_mm_set1_epi32(ty.weight[0]), _mm_set1_epi32(ty.weight[1]),
+				_mm_set1_epi32(ty.weight[2]), _mm_set1_epi32(ty.weight[3])
+			};
+			for (int x = 0; x < dstrect.Width(); x++) {
+				ptr[x] = StretchPixelSSE41(src.lpPixels, colors, tapsX[x], rows, wy);
+			}
+		} else {
+			for (int x = 0; x < dstrect.Width(); x++) {
+				ptr[x] = StretchPixel(src.lpPixels, tapsX[x], rows, ty.weight);
+			}
+		}
+	}
+
+	_aligned_free(colors);
 }
 
 static void StretchBlt(SubPicDesc& spd, CRect dstrect, CVobSubImage& src)
@@ -1531,30 +1900,55 @@ static void StretchBlt(SubPicDesc& spd, CRect dstrect, CVobSubImage& src)
 	dw = dstrect.Width();
 	dh = dstrect.Height();
 
-	for (int y = dstrect.top; y < dstrect.bottom; y++, srcy += (srcdy<<1)) {
-		RGBQUAD* ptr = (RGBQUAD*)&(spd.bits)[y*spd.pitch] + dstrect.left;
-		RGBQUAD* endptr = ptr + dw;
+	std::vector<StretchTaps> tapsX, tapsY;
+	CalcStretchTaps(tapsX, dw, srcx, srcdx, sw);
+	CalcStretchTaps(tapsY, dh, srcy, srcdy, sh);
 
-		for (int sx = srcx; ptr < endptr; sx += (srcdx<<1), ptr++) {
-			RGBQUAD cc[4];
-
-			PixelAtBiLinear(cc[0],	sx,			srcy,		src);
-			PixelAtBiLinear(cc[1],	sx+srcdx,	srcy,		src);
-			PixelAtBiLinear(cc[2],	sx,			srcy+srcdy,	src);
-			PixelAtBiLinear(cc[3],	sx+srcdx,	srcy+srcdy,	src);
+	static const bool bSSE41 = CPUInfo::HaveSSE4();
+	if (bSSE41) {
+		StretchRows<true>(spd, dstrect, src, tapsX, tapsY);
+	} else {
+		StretchRows<false>(spd, dstrect, src, tapsX, tapsY);
+	}
+}
 
-			ptr->rgbRed = (cc[0].rgbRed + cc[1].rgbRed + cc[2].rgbRed + cc[3].rgbRed) >> 2;
-			ptr->rgbGreen = (cc[0].rgbGreen + cc[1].rgbGreen + cc[2].rgbGreen + cc[3].rgbGreen) >> 2;
-			ptr->rgbBlue = (cc[0].rgbBlue + cc[1].rgbBlue + cc[2].rgbBlue + cc[3].rgbBlue) >> 2;
-			ptr->rgbReserved = (cc[0].rgbReserved + cc[1].rgbReserved + cc[2].rgbReserved + cc[3].rgbReserved) >> 2;
-			////
-			ptr->rgbRed = ptr->rgbRed * ptr->rgbReserved >> 8;
-			ptr->rgbGreen = ptr->rgbGreen * ptr->rgbReserved >> 8;
-			ptr->rgbBlue = ptr->rgbBlue * ptr->rgbReserved >> 8;
-			ptr->rgbReserved = ~ptr->rgbReserved;
+double CVobSubFile::BenchmarkStretch(CSize srcsize, CSize dstsize, int nFrames)
+{
+	CVobSubImage img;
+	if (srcsize.cx <= 0 || srcsize.cy <= 0 || nFrames <= 0 || !img.Alloc(srcsize.cx, srcsize.cy)) {
+		return 0.0;
+	}
+	img.rect.SetRect(0, 0, srcsize.cx, srcsize.cy);
 
+	// transparent except for a band of "text" at the bottom with opaque, semi-transparent and clear pixels
+	for (int y = 0; y < srcsize.cy; y++) {
+		for (int x = 0; x < srcsize.cx; x++) {
+			RGBQUAD& c = img.lpPixels[y * srcsize.cx + x];
+			const bool bText = y >= srcsize.cy * 3 / 4 && y < srcsize.cy * 15 / 16 && x >= srcsize.cx / 8 && x < srcsize.cx * 7 / 8;
+			const int k = (x * 7 + y * 13) % 8;
+			const BYTE alpha = !bText || k < 3 ? 0 : k < 6 ? 255 : 128;
+			c.rgbBlue = c.rgbGreen = c.rgbRed = k < 5 ? 0xff : 0x10;
+			c.rgbReserved = alpha;
 		}
 	}
+
+	std::unique_ptr<BYTE[]> bits(DNew BYTE[dstsize.cx * dstsize.cy * 4]);
+
+	SubPicDesc spd;
+	spd.w = dstsize.cx;
+	spd.h = dstsize.cy;
+	spd.bpp = 32;
+	spd.pitch = dstsize.cx * 4;
+	spd.bits = bits.get();
+	spd.vidrect = {0, 0, dstsize.cx, dstsize.cy};
+
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < nFrames; i++) {
+		StretchBlt(spd, CRect(0, 0, dstsize.cx, dstsize.cy), img);
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return seconds > 0.0 ? nFrames / seconds : 0.0;
 }
 
 //
@@ -1709,58 +2103,186 @@ static bool CompressFile(CString fn)
 	return !!b;
 }
 
-bool CVobSubFile::SaveVobSub(CString fn)
+static void AppendData(std::vector<BYTE>& data, const void* p, size_t size)
 {
-	return WriteIdx(fn + L".idx") && WriteSub(fn + L".sub");
+	data.insert(data.end(), (const BYTE*)p, (const BYTE*)p + size);
 }
 
-bool CVobSubFile::SaveWinSubMux(CString fn)
+// the first transparent color is the background, the first one if there is none
+static int GetBackgroundColor(const CVobSubImage::SubPal* pal)
 {
-	TrimExtension(fn);
+	int j = 0;
+	while (j < 4 && pal[j].tr) {
+		j++;
+	}
 
-	CStdioFile f;
-	if (!f.Open(fn + L".sub", CFile::modeCreate|CFile::modeWrite|CFile::typeText|CFile::shareDenyWrite)) {
-		return false;
+	return j & 3;
+}
+
+void CVobSubFile::ExportImages(std::function<void(const CVobSubImage& img, ExportImage& image)> process,
+							   std::function<void(size_t idx, const ExportImage& image)> write)
+{
+	const int nLang = m_nLang;
+	const size_t count = m_langs[nLang].subpos.size();
+	if (!count) {
+		return;
 	}
 
-	m_img.Invalidate();
+	// the palettes are copied, the workers don't use m_img
+	const DecodedPalette palette = GetDecodedPalette();
+	RGBQUAD orgpal[16], cuspal[4];
+	memcpy(orgpal, m_orgpal, sizeof(orgpal));
+	memcpy(cuspal, palette.cuspal, sizeof(cuspal));
 
-	std::unique_ptr<BYTE[]> p4bpp(new(std::nothrow) BYTE[720*576/2]);
-	if (!p4bpp) {
-		return false;
+	const size_t nThreads = std::min<size_t>(m_nExportThreads ? m_nExportThreads : std::clamp<size_t>(CPUInfo::GetProcessorNumber(), 1, 16), count);
+
+	// the workers don't get further ahead of the writer than the number of slots
+	std::vector<ExportImage> images(nThreads * 4);
+	std::vector<char> ready(images.size());
+	size_t next = 0, written = 0;
+	std::exception_ptr error; // the first exception of a worker, rethrown by the calling thread
+	std::mutex mutex;
+	std::condition_variable cond;
+
+	auto worker = [&] {
+		CVobSubImage img;
+
+		for (;;) {
+			size_t idx;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cond.wait(lock, [&] { return next >= count || next < written + images.size(); });
+				if (next >= count) {
+					break;
+				}
+				idx = next++;
+			}
+
+			ExportImage image;
+
+			try {
+				int packetsize = 0, datasize = 0;
+				std::unique_ptr<BYTE[]> buff(GetPacket(idx, packetsize, datasize, nLang));
+				if (buff && packetsize > 0 && datasize > 0
+						&& img.Decode(buff.get(), packetsize, datasize, INT_MAX, palette.bCustomPal, palette.tridx, orgpal, cuspal, true)
+						&& (!m_bOnlyShowForcedSubs || img.bForced)) {
+					image.bValid = true;
+					image.rect = img.rect;
+					memcpy(image.pal, img.pal, sizeof(image.pal));
+					process(img, image);
+				}
+			} catch (...) {
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					if (!error) {
+						error = std::current_exception();
+					}
+					next = count;
+				}
+				cond.notify_all();
+				break;
+			}
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				images[idx % images.size()] = std::move(image);
+				ready[idx % images.size()] = true;
+			}
+			cond.notify_all();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < nThreads; i++) {
+		threads.emplace_back(worker);
 	}
 
-	std::vector<SubPos>& sp = m_langs[m_nLang].subpos;
-	for (size_t i = 0; i < sp.size(); i++) {
-		if (!GetFrame(i)) {
-			continue;
+	auto stopWorkers = [&] {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			next = count;
 		}
+		cond.notify_all();
 
-		int pal[4] = {0, 1, 2, 3};
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	};
 
-		for (int j = 0; j < 5; j++) {
-			if (j == 4 || !m_img.pal[j].tr) {
-				j &= 3;
-				memset(p4bpp.get(), (j<<4)|j, 720*576/2);
-				pal[j] ^= pal[0], pal[0] ^= pal[j], pal[j] ^= pal[0];
-				break;
+	const auto start = std::chrono::steady_clock::now();
+	double rate = 0.0;
+
+	try {
+		for (size_t i = 0; i < count; i++) {
+			ExportImage image;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				const size_t n = i % images.size();
+				cond.wait(lock, [&] { return ready[n] || error; });
+				if (error) {
+					break;
+				}
+				image = std::move(images[n]);
+				ready[n] = false;
+				written++;
+			}
+			cond.notify_all();
+
+			if (image.bValid) {
+				write(i, image);
+			}
+
+			const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			rate = seconds > 0.0 ? (i + 1) / seconds : 0.0;
+			if (m_fnExportProgress) {
+				m_fnExportProgress(i + 1, count, rate);
 			}
 		}
+	} catch (...) {
+		stopWorkers();
+		throw;
+	}
 
-		int tr[4] = {m_img.pal[pal[0]].tr, m_img.pal[pal[1]].tr, m_img.pal[pal[2]].tr, m_img.pal[pal[3]].tr};
+	stopWorkers();
 
-		DWORD uipal[4+12];
+	if (error) {
+		std::rethrow_exception(error);
+	}
+
+	DLog(L"CVobSubFile::ExportImages() : %Iu images, %Iu threads, %.1f images/s", count, nThreads, rate);
+}
+
+bool CVobSubFile::SaveVobSub(CString fn)
+{
+	return WriteIdx(fn + L".idx") && WriteSub(fn + L".sub");
+}
+
+bool CVobSubFile::SaveWinSubMux(CString fn)
+{
+	TrimExtension(fn);
+
+	CStdioFile f;
+	if (!f.Open(fn + L".sub", CFile::modeCreate|CFile::modeWrite|CFile::typeText|CFile::shareDenyWrite)) {
+		return false;
+	}
+
+	auto process = [this](const CVobSubImage& img, ExportImage& image) {
+		const int bg = GetBackgroundColor(img.pal);
+		int pal[4] = {0, 1, 2, 3};
+		std::swap(pal[0], pal[bg]);
+
+		DWORD uipal[4+12] = {};
 
 		if (!m_bCustomPal) {
-			uipal[0] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[0]].pal]);
-			uipal[1] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[1]].pal]);
-			uipal[2] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[2]].pal]);
-			uipal[3] = *((DWORD*)&m_img.orgpal[m_img.pal[pal[3]].pal]);
+			uipal[0] = *((DWORD*)&m_orgpal[img.pal[pal[0]].pal]);
+			uipal[1] = *((DWORD*)&m_orgpal[img.pal[pal[1]].pal]);
+			uipal[2] = *((DWORD*)&m_orgpal[img.pal[pal[2]].pal]);
+			uipal[3] = *((DWORD*)&m_orgpal[img.pal[pal[3]].pal]);
 		} else {
-			uipal[0] = *((DWORD*)&m_img.cuspal[pal[0]]) & 0xffffff;
-			uipal[1] = *((DWORD*)&m_img.cuspal[pal[1]]) & 0xffffff;
-			uipal[2] = *((DWORD*)&m_img.cuspal[pal[2]]) & 0xffffff;
-			uipal[3] = *((DWORD*)&m_img.cuspal[pal[3]]) & 0xffffff;
+			uipal[0] = *((DWORD*)&m_cuspal[pal[0]]) & 0xffffff;
+			uipal[1] = *((DWORD*)&m_cuspal[pal[1]]) & 0xffffff;
+			uipal[2] = *((DWORD*)&m_cuspal[pal[2]]) & 0xffffff;
+			uipal[3] = *((DWORD*)&m_cuspal[pal[3]]) & 0xffffff;
 		}
 
 		CAtlMap<DWORD,BYTE> palmap;
@@ -1771,12 +2293,14 @@ bool CVobSubFile::SaveWinSubMux(CString fn)
 
 		uipal[0] = 0xff; // blue background
 
-		int w = m_img.rect.Width()-2;
-		int h = m_img.rect.Height()-2;
+		int w = img.rect.Width()-2;
+		int h = img.rect.Height()-2;
 		int pitch = (((w+1)>>1) + 3) & ~3;
 
+		std::vector<BYTE> p4bpp(std::max(pitch*h, 0), (BYTE)((bg<<4)|bg));
+
 		for (ptrdiff_t y = 0; y < h; y++) {
-			DWORD* p = (DWORD*)&m_img.lpPixels[(y+1)*(w+2)+1];
+			DWORD* p = (DWORD*)&img.lpPixels[(y+1)*(w+2)+1];
 
 			for (ptrdiff_t x = 0; x < w; x++, p++) {
 				BYTE c = 0;
@@ -1791,13 +2315,42 @@ bool CVobSubFile::SaveWinSubMux(CString fn)
 			}
 		}
 
-		int t1 = (int)m_img.start;
-		int t2 = t1 + (int)m_img.delay /*+ (m_size.cy==480?(1000/29.97+1):(1000/25))*/;
+		BITMAPFILEHEADER fhdr = {
+			0x4d42,
+			sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16*sizeof(RGBQUAD) + pitch*h,
+			0, 0,
+			sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16*sizeof(RGBQUAD)
+		};
+
+		BITMAPINFOHEADER ihdr = {
+			sizeof(BITMAPINFOHEADER),
+			w, h, 1, 4, 0,
+			0,
+			pitch*h, 0,
+			16, 4
+		};
+
+		AppendData(image.bitmap, &fhdr, sizeof(fhdr));
+		AppendData(image.bitmap, &ihdr, sizeof(ihdr));
+		AppendData(image.bitmap, uipal, sizeof(RGBQUAD)*16);
+		AppendData(image.bitmap, p4bpp.data(), p4bpp.size());
+	};
+
+	std::vector<SubPos>& sp = m_langs[m_nLang].subpos;
+
+	auto write = [&](size_t i, const ExportImage& image) {
+		int pal[4] = {0, 1, 2, 3};
+		std::swap(pal[0], pal[GetBackgroundColor(image.pal)]);
+
+		int tr[4] = {image.pal[pal[0]].tr, image.pal[pal[1]].tr, image.pal[pal[2]].tr, image.pal[pal[3]].tr};
+
+		int t1 = (int)sp[i].start;
+		int t2 = t1 + (int)(sp[i].stop - sp[i].start) /*+ (m_size.cy==480?(1000/29.97+1):(1000/25))*/;
 
 		ASSERT(t2>t1);
 
 		if (t2 <= 0) {
-			continue;
+			return;
 		}
 		if (t1 < 0) {
 			t1 = 0;
@@ -1811,36 +2364,20 @@ bool CVobSubFile::SaveWinSubMux(CString fn)
 				   bmpfn,
 				   t1/1000/60/60, (t1/1000/60)%60, (t1/1000)%60, (t1%1000)/10,
 				   t2/1000/60/60, (t2/1000/60)%60, (t2/1000)%60, (t2%1000)/10,
-				   m_img.rect.Width(), m_img.rect.Height(), m_img.rect.left, m_img.rect.top,
+				   image.rect.Width(), image.rect.Height(), image.rect.left, image.rect.top,
 				   (tr[0]<<4)|tr[0], (tr[1]<<4)|tr[1], (tr[2]<<4)|tr[2], (tr[3]<<4)|tr[3]);
 		f.WriteString(str);
 
-		BITMAPFILEHEADER fhdr = {
-			0x4d42,
-			sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16*sizeof(RGBQUAD) + pitch*h,
-			0, 0,
-			sizeof(BITMAPFILEHEADER) + sizeof(BITMAPINFOHEADER) + 16*sizeof(RGBQUAD)
-		};
-
-		BITMAPINFOHEADER ihdr = {
-			sizeof(BITMAPINFOHEADER),
-			w, h, 1, 4, 0,
-			0,
-			pitch*h, 0,
-			16, 4
-		};
-
 		CFile bmp;
 		if (bmp.Open(bmpfn, CFile::modeCreate|CFile::modeWrite|CFile::typeBinary|CFile::shareDenyWrite)) {
-			bmp.Write(&fhdr, sizeof(fhdr));
-			bmp.Write(&ihdr, sizeof(ihdr));
-			bmp.Write(uipal, sizeof(RGBQUAD)*16);
-			bmp.Write(p4bpp.get(), pitch*h);
+			bmp.Write(image.bitmap.data(), (UINT)image.bitmap.size());
 			bmp.Close();
 
 			CompressFile(bmpfn);
 		}
-	}
+	};
+
+	ExportImages(process, write);
 
 	return true;
 }
@@ -1854,8 +2391,6 @@ bool CVobSubFile::SaveScenarist(CString fn)
 		return false;
 	}
 
-	m_img.Invalidate();
-
 	fn.Replace('\\', '/');
 	CString title = fn.Mid(fn.ReverseFind('/')+1);
 
@@ -1936,10 +2471,10 @@ bool CVobSubFile::SaveScenarist(CString fn)
 	memcpy(tempCusPal, m_cuspal, sizeof(tempCusPal));
 	memcpy(m_cuspal, newCusPal, sizeof(m_cuspal));
 
-	std::unique_ptr<BYTE[]> p4bpp(new(std::nothrow) BYTE[(m_size.cy - 2) * 360]);
-	if (!p4bpp) {
-		return false;
-	}
+	std::vector<BYTE> header;
+	AppendData(header, &fhdr, sizeof(fhdr));
+	AppendData(header, &ihdr, sizeof(ihdr));
+	AppendData(header, newCusPal, sizeof(RGBQUAD)*16);
 
 	BYTE colormap[16];
 
@@ -1963,42 +2498,39 @@ bool CVobSubFile::SaveScenarist(CString fn)
 
 	int pc[4] = {1, 1, 1, 1}, pa[4] = {15, 15, 15, 0};
 
-	std::vector<SubPos>& sp = m_langs[m_nLang].subpos;
-	for (size_t i = 0, k = 0; i < sp.size(); i++) {
-		if (!GetFrame(i)) {
-			continue;
-		}
+	auto process = [&](const CVobSubImage& img, ExportImage& image) {
+		const int bg = GetBackgroundColor(img.pal);
+		image.bitmap = header;
+		image.bitmap.resize(header.size() + 360*(m_size.cy-2), (BYTE)((bg<<4)|bg));
+		BYTE* p4bpp = image.bitmap.data() + header.size();
 
-		for (int j = 0; j < 5; j++) {
-			if (j == 4 || !m_img.pal[j].tr) {
-				j &= 3;
-				memset(p4bpp.get(), (j<<4)|j, (m_size.cy-2)*360);
-				break;
-			}
-		}
-
-		for (LONG y = std::max(m_img.rect.top + 1, 2L); y < m_img.rect.bottom - 1; y++) {
+		for (LONG y = std::max(img.rect.top + 1, 2L); y < img.rect.bottom - 1; y++) {
 			ASSERT(m_size.cy-y-1 >= 0);
 			if (m_size.cy-y-1 < 0) {
 				break;
 			}
 
-			DWORD* p = (DWORD*)&m_img.lpPixels[(y-m_img.rect.top)*m_img.rect.Width()+1];
+			DWORD* p = (DWORD*)&img.lpPixels[(y-img.rect.top)*img.rect.Width()+1];
 
-			for (LONG x = m_img.rect.left+1; x < m_img.rect.right-1; x++, p++) {
+			for (LONG x = img.rect.left+1; x < img.rect.right-1; x++, p++) {
 				DWORD rgb = *p&0xffffff;
 				BYTE c = rgb == 0x0000ff ? 0 : rgb == 0xff0000 ? 1 : rgb == 0x000000 ? 2 : 3;
 				BYTE& c4bpp = p4bpp[(m_size.cy-y-1)*360+(x>>1)];
 				c4bpp = (x&1) ? ((c4bpp&0xf0)|c) : ((c4bpp&0x0f)|(c<<4));
 			}
 		}
+	};
+
+	std::vector<SubPos>& sp = m_langs[m_nLang].subpos;
+	size_t k = 0;
 
+	auto write = [&](size_t i, const ExportImage& image) {
 		CString bmpfn;
 		bmpfn.Format(L"%s_%04zu.bmp", fn, i+1);
 		title = bmpfn.Mid(bmpfn.ReverseFind('/')+1);
 
 		// E1, E2, P, Bg
-		int c[4] = {colormap[m_img.pal[1].pal], colormap[m_img.pal[2].pal], colormap[m_img.pal[0].pal], colormap[m_img.pal[3].pal]};
+		int c[4] = {colormap[image.pal[1].pal], colormap[image.pal[2].pal], colormap[image.pal[0].pal], colormap[image.pal[3].pal]};
 		c[0]^=c[1], c[1]^=c[0], c[0]^=c[1];
 
 		if (memcmp(pc, c, sizeof(c))) {
@@ -2008,7 +2540,7 @@ bool CVobSubFile::SaveScenarist(CString fn)
 		}
 
 		// E1, E2, P, Bg
-		int a[4] = {m_img.pal[1].tr, m_img.pal[2].tr, m_img.pal[0].tr, m_img.pal[3].tr};
+		int a[4] = {image.pal[1].tr, image.pal[2].tr, image.pal[0].tr, image.pal[3].tr};
 		a[0]^=a[1], a[1]^=a[0], a[0]^=a[1];
 
 		if (memcmp(pa, a, sizeof(a))) {
@@ -2026,7 +2558,7 @@ bool CVobSubFile::SaveScenarist(CString fn)
 		int f2 = (int)((m_size.cy==480?29.97:25)*(t2%1000)/1000);
 
 		if (t2 <= 0) {
-			continue;
+			return;
 		}
 		if (t1 < 0) {
 			t1 = 0;
@@ -2073,7 +2605,7 @@ bool CVobSubFile::SaveScenarist(CString fn)
 		}
 
 		if (h1 == h2 && m1 == m2 && s1 == s2 && f1 == f2) {
-			continue;
+			return;
 		}
 
 		str.Format(L"%04zu\t%02d:%02d:%02d:%02d\t%02d:%02d:%02d:%02d\t%s\n",
@@ -2085,15 +2617,14 @@ bool CVobSubFile::SaveScenarist(CString fn)
 
 		CFile bmp;
 		if (bmp.Open(bmpfn, CFile::modeCreate|CFile::modeWrite|CFile::modeRead|CFile::typeBinary)) {
-			bmp.Write(&fhdr, sizeof(fhdr));
-			bmp.Write(&ihdr, sizeof(ihdr));
-			bmp.Write(newCusPal, sizeof(RGBQUAD)*16);
-			bmp.Write(p4bpp.get(), 360*(m_size.cy-2));
+			bmp.Write(image.bitmap.data(), (UINT)image.bitmap.size());
 			bmp.Close();
 
 			CompressFile(bmpfn);
 		}
-	}
+	};
+
+	ExportImages(process, write);
 
 	m_bCustomPal = bCustomPal;
 	memcpy(m_cuspal, tempCusPal, sizeof(m_cuspal));
@@ -2110,8 +2641,6 @@ bool CVobSubFile::SaveMaestro(CString fn)
 		return false;
 	}
 
-	m_img.Invalidate();
-
 	fn.Replace('\\', '/');
 	CString title = fn.Mid(fn.ReverseFind('/')+1);
 
@@ -2168,10 +2697,10 @@ bool CVobSubFile::SaveMaestro(CString fn)
 	memcpy(tempCusPal, m_cuspal, sizeof(tempCusPal));
 	memcpy(m_cuspal, newCusPal, sizeof(m_cuspal));
 
-	std::unique_ptr<BYTE[]> p4bpp(new(std::nothrow) BYTE[(m_size.cy - 2) * 360]);
-	if (!p4bpp) {
-		return false;
-	}
+	std::vector<BYTE> header;
+	AppendData(header, &fhdr, sizeof(fhdr));
+	AppendData(header, &ihdr, sizeof(ihdr));
+	AppendData(header, newCusPal, sizeof(RGBQUAD)*16);
 
 	BYTE colormap[16];
 	for (BYTE i = 0; i < 16; i++) {
@@ -2190,42 +2719,39 @@ bool CVobSubFile::SaveMaestro(CString fn)
 
 	int pc[4] = {1,1,1,1}, pa[4] = {15,15,15,0};
 
-	std::vector<SubPos>& sp = m_langs[m_nLang].subpos;
-	for (size_t i = 0, k = 0; i < sp.size(); i++) {
-		if (!GetFrame(i)) {
-			continue;
-		}
-
-		for (int j = 0; j < 5; j++) {
-			if (j == 4 || !m_img.pal[j].tr) {
-				j &= 3;
-				memset(p4bpp.get(), (j<<4)|j, (m_size.cy-2)*360);
-				break;
-			}
-		}
+	auto process = [&](const CVobSubImage& img, ExportImage& image) {
+		const int bg = GetBackgroundColor(img.pal);
+		image.bitmap = header;
+		image.bitmap.resize(header.size() + 360*(m_size.cy-2), (BYTE)((bg<<4)|bg));
+		BYTE* p4bpp = image.bitmap.data() + header.size();
 
-		for (LONG y = std::max(m_img.rect.top+1, 2L); y < m_img.rect.bottom-1; y++) {
+		for (LONG y = std::max(img.rect.top+1, 2L); y < img.rect.bottom-1; y++) {
 			ASSERT(m_size.cy-y-1 >= 0);
 			if (m_size.cy-y-1 < 0) {
 				break;
 			}
 
-			DWORD* p = (DWORD*)&m_img.lpPixels[(y-m_img.rect.top)*m_img.rect.Width()+1];
+			DWORD* p = (DWORD*)&img.lpPixels[(y-img.rect.top)*img.rect.Width()+1];
 
-			for (LONG x = m_img.rect.left+1; x < m_img.rect.right-1; x++, p++) {
+			for (LONG x = img.rect.left+1; x < img.rect.right-1; x++, p++) {
 				DWORD rgb = *p&0xffffff;
 				BYTE c = rgb == 0x0000ff ? 0 : rgb == 0xff0000 ? 1 : rgb == 0x000000 ? 2 : 3;
 				BYTE& c4bpp = p4bpp[(m_size.cy-y-1)*360+(x>>1)];
 				c4bpp = (x&1) ? ((c4bpp&0xf0)|c) : ((c4bpp&0x0f)|(c<<4));
 			}
 		}
+	};
+
+	std::vector<SubPos>& sp = m_langs[m_nLang].subpos;
+	size_t k = 0;
 
+	auto write = [&](size_t i, const ExportImage& image) {
 		CString bmpfn;
 		bmpfn.Format(L"%s_%04zu.bmp", fn, i+1);
 		title = bmpfn.Mid(bmpfn.ReverseFind('/')+1);
 
 		// E1, E2, P, Bg
-		int c[4] = {colormap[m_img.pal[1].pal], colormap[m_img.pal[2].pal], colormap[m_img.pal[0].pal], colormap[m_img.pal[3].pal]};
+		int c[4] = {colormap[image.pal[1].pal], colormap[image.pal[2].pal], colormap[image.pal[0].pal], colormap[image.pal[3].pal]};
 
 		if (memcmp(pc, c, sizeof(c))) {
 			memcpy(pc, c, sizeof(c));
@@ -2234,7 +2760,7 @@ bool CVobSubFile::SaveMaestro(CString fn)
 		}
 
 		// E1, E2, P, Bg
-		int a[4] = {m_img.pal[1].tr, m_img.pal[2].tr, m_img.pal[0].tr, m_img.pal[3].tr};
+		int a[4] = {image.pal[1].tr, image.pal[2].tr, image.pal[0].tr, image.pal[3].tr};
 
 		if (memcmp(pa, a, sizeof(a))) {
 			memcpy(pa, a, sizeof(a));
@@ -2251,7 +2777,7 @@ bool CVobSubFile::SaveMaestro(CString fn)
 		int f2 = (int)((m_size.cy==480?29.97:25)*(t2%1000)/1000);
 
 		if (t2 <= 0) {
-			continue;
+			return;
 		}
 		if (t1 < 0) {
 			t1 = 0;
@@ -2298,7 +2824,7 @@ bool CVobSubFile::SaveMaestro(CString fn)
 		}
 
 		if (h1 == h2 && m1 == m2 && s1 == s2 && f1 == f2) {
-			continue;
+			return;
 		}
 
 		str.Format(L"%04zu\t%02d:%02d:%02d:%02d\t%02d:%02d:%02d:%02d\t%s\n",
@@ -2310,15 +2836,14 @@ bool CVobSubFile::SaveMaestro(CString fn)
 
 		CFile bmp;
 		if (bmp.Open(bmpfn, CFile::modeCreate|CFile::modeWrite|CFile::typeBinary)) {
-			bmp.Write(&fhdr, sizeof(fhdr));
-			bmp.Write(&ihdr, sizeof(ihdr));
-			bmp.Write(newCusPal, sizeof(RGBQUAD)*16);
-			bmp.Write(p4bpp.get(), 360*(m_size.cy-2));
+			bmp.Write(image.bitmap.data(), (UINT)image.bitmap.size());
 			bmp.Close();
 
 			CompressFile(bmpfn);
 		}
-	}
+	};
+
+	ExportImages(process, write);
 
 	m_bCustomPal = bCustomPal;
 	memcpy(m_cuspal, tempCusPal, sizeof(m_cuspal));
@@ -2433,11 +2958,9 @@ void CVobSubStream::Add(REFERENCE_TIME tStart, REFERENCE_TIME tStop, BYTE* pData
 
 	{
 		CAutoLock cAutoLock(&m_csSubPics);
-		POSITION pos = m_subpics.GetTailPosition();
-		while (pos) {
-			SubPic* sp = m_subpics.GetPrev(pos);
-			if (sp->tStop == _I64_MAX) {
-				sp->tStop = tStart;
+		for (auto it = m_subpics.rbegin(); it != m_subpics.rend(); ++it) {
+			if (it->tStop == _I64_MAX) {
+				it->tStop = tStart;
 				break;
 			}
 		}
@@ -2446,42 +2969,70 @@ void CVobSubStream::Add(REFERENCE_TIME tStart, REFERENCE_TIME tStop, BYTE* pData
 	CVobSubImage vsi;
 	vsi.GetPacketInfo(pData, (pData[0] << 8) | pData[1], (pData[2] << 8) | pData[3]);
 
-	CAutoPtr<SubPic> p(DNew SubPic());
-	p->tStart		= tStart;
-	p->tStop		= vsi.delay > 0 ? (tStart + 10000i64 * vsi.delay) : tStop;
-	p->bAnimated	= vsi.bAnimated;
-	p->bForced		= vsi.bForced;
-	if (p->tStop - p->tStart < UNITS/100) {
-		p->tStop	= _I64_MAX;
+	SubPic p;
+	p.tStart	= tStart;
+	p.tStop		= vsi.delay > 0 ? (tStart + 10000i64 * vsi.delay) : tStop;
+	p.bAnimated	= vsi.bAnimated;
+	p.bForced	= vsi.bForced;
+	if (p.tStop - p.tStart < UNITS/100) {
+		p.tStop	= _I64_MAX;
 	}
-	p->pData.SetCount(len);
-	memcpy(p->pData.GetData(), pData, p->pData.GetCount());
+	p.pData.assign(pData, pData + len);
 
 	CAutoLock cAutoLock(&m_csSubPics);
-	while (m_subpics.GetCount() && m_subpics.GetTail()->tStart >= tStart) {
-		m_subpics.RemoveTailNoReturn();
+	while (m_subpics.size() && m_subpics.back().tStart >= tStart) {
+		m_subpics.pop_back();
 		m_img.nIdx = -1;
 	}
 
 	// We can only render one subpicture at a time, thus if there is overlap
 	// we have to fix it. tStop = tStart seems to work.
-	if (m_subpics.GetCount() && m_subpics.GetTail()->tStop > p->tStart) {
+	if (m_subpics.size() && m_subpics.back().tStop > p.tStart) {
 		DLog(L"[CVobSubStream::Add] Vobsub timestamp overlap detected!"
-			 L"Subpicture #%d, StopTime %I64d > %I64d (Next StartTime), making them equal!",
-			 m_subpics.GetCount(), m_subpics.GetTail()->tStop, p->tStart);
-		m_subpics.GetTail()->tStop = p->tStart;
+			 L"Subpicture #%Iu, StopTime %I64d > %I64d (Next StartTime), making them equal!",
+			 m_nFirstSubPic + m_subpics.size(), m_subpics.back().tStop, p.tStart);
+		m_subpics.back().tStop = p.tStart;
 	}
 
-	m_subpics.AddTail(p);
+	m_subpics.emplace_back(std::move(p));
 }
 
 void CVobSubStream::RemoveAll()
 {
 	CAutoLock cAutoLock(&m_csSubPics);
-	m_subpics.RemoveAll();
+	m_nFirstSubPic += m_subpics.size();
+	m_subpics.clear();
 	m_img.nIdx = -1;
 }
 
+const CVobSubStream::SubPic* CVobSubStream::GetSubPic(POSITION pos) const
+{
+	const size_t n = (size_t)pos - 1;
+	if (!pos || n < m_nFirstSubPic || n - m_nFirstSubPic >= m_subpics.size()) {
+		return nullptr;
+	}
+
+	return &m_subpics[n - m_nFirstSubPic];
+}
+
+// index of the last subpicture starting at or before rt, or SIZE_MAX
+size_t CVobSubStream::FindSubPic(REFERENCE_TIME rt) const
+{
+	auto it = std::upper_bound(m_subpics.cbegin(), m_subpics.cend(), rt, [](REFERENCE_TIME rt, const SubPic& sp) {
+		return rt < sp.tStart;
+	});
+
+	return (size_t)(it - m_subpics.cbegin()) - 1;
+}
+
+void CVobSubStream::CleanOld(REFERENCE_TIME rt)
+{
+	while (m_subpics.size() && m_subpics.front().tStop < rt) {
+		m_subpics.pop_front();
+		m_nFirstSubPic++;
+	}
+}
+
 STDMETHODIMP CVobSubStream::NonDelegatingQueryInterface(REFIID riid, void** ppv)
 {
 	CheckPointer(ppv, E_POINTER);
@@ -2499,45 +3050,49 @@ STDMETHODIMP CVobSubStream::NonDelegatingQueryInterface(REFIID riid, void** ppv)
 STDMETHODIMP_(POSITION) CVobSubStream::GetStartPosition(REFERENCE_TIME rt, double fps, bool CleanOld/* = false*/)
 {
 	CAutoLock cAutoLock(&m_csSubPics);
-	POSITION pos = m_subpics.GetTailPosition();
-	for (; pos; m_subpics.GetPrev(pos)) {
-		SubPic* sp = m_subpics.GetAt(pos);
-		if (sp->tStart <= rt) {
-			if (g_bForcedSubtitle && !sp->bForced) {
-				continue;
-			}
-			if (sp->tStop <= rt) {
-				m_subpics.GetNext(pos);
-			}
-			break;
+
+	size_t i = FindSubPic(rt);
+	if (g_bForcedSubtitle) {
+		while (i < m_subpics.size() && !m_subpics[i].bForced) {
+			i--;
 		}
 	}
-	return pos;
+	if (i >= m_subpics.size()) {
+		return nullptr;
+	}
+	if (m_subpics[i].tStop <= rt && ++i == m_subpics.size()) {
+		return nullptr;
+	}
+
+	return (POSITION)(m_nFirstSubPic + i + 1);
 }
 
 STDMETHODIMP_(POSITION) CVobSubStream::GetNext(POSITION pos)
 {
 	CAutoLock cAutoLock(&m_csSubPics);
-	m_subpics.GetNext(pos);
-	return pos;
+	pos = (POSITION)((size_t)pos + 1);
+	return GetSubPic(pos) ? pos : nullptr;
 }
 
 STDMETHODIMP_(REFERENCE_TIME) CVobSubStream::GetStart(POSITION pos, double fps)
 {
 	CAutoLock cAutoLock(&m_csSubPics);
-	return m_subpics.GetAt(pos)->tStart;
+	const SubPic* sp = GetSubPic(pos);
+	return sp ? sp->tStart : 0;
 }
 
 STDMETHODIMP_(REFERENCE_TIME) CVobSubStream::GetStop(POSITION pos, double fps)
 {
 	CAutoLock cAutoLock(&m_csSubPics);
-	return m_subpics.GetAt(pos)->tStop;
+	const SubPic* sp = GetSubPic(pos);
+	return sp ? sp->tStop : 0;
 }
 
 STDMETHODIMP_(bool) CVobSubStream::IsAnimated(POSITION pos)
 {
 	CAutoLock cAutoLock(&m_csSubPics);
-	return m_subpics.GetAt(pos)->bAnimated;
+	const SubPic* sp = GetSubPic(pos);
+	return sp ? sp->bAnimated : false;
 }
 
 STDMETHODIMP CVobSubStream::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fps, RECT& bbox)
@@ -2546,23 +3101,32 @@ STDMETHODIMP CVobSubStream::Render(SubPicDesc& spd, REFERENCE_TIME rt, double fp
 		return E_INVALIDARG;
 	}
 
-	POSITION pos = m_subpics.GetTailPosition();
-	for (; pos; m_subpics.GetPrev(pos)) {
-		SubPic* sp = m_subpics.GetAt(pos);
-		if (sp->tStart <= rt && rt < sp->tStop) {
-			if (m_img.nIdx != (size_t)pos || (sp->bAnimated && sp->tStart + m_img.tCurrent * 10000i64 <= rt)) {
-				BYTE* pData = sp->pData.GetData();
-				m_img.Decode(
-					pData, (pData[0] << 8) | pData[1], (pData[2] << 8) | pData[3], int((rt - sp->tStart) / 10000i64),
-					m_bCustomPal, m_tridx, m_orgpal, m_cuspal, true);
-				m_img.nIdx = (size_t)pos;
-			}
+	CAutoLock cAutoLock(&m_csSubPics);
 
-			return __super::Render(spd, bbox);
-		}
+	if (m_rtRetainBehind > 0) {
+		CleanOld(rt - m_rtRetainBehind);
 	}
 
-	return E_FAIL;
+	const size_t i = FindSubPic(rt);
+	if (i >= m_subpics.size()) {
+		return E_FAIL;
+	}
+
+	SubPic& sp = m_subpics[i];
+	if (rt >= sp.tStop) {
+		return E_FAIL;
+	}
+
+	const size_t n = m_nFirstSubPic + i;
+	if (m_img.nIdx != n || (sp.bAnimated && sp.tStart + m_img.tCurrent * 10000i64 <= rt)) {
+		BYTE* pData = sp.pData.data();
+		m_img.Decode(
+			pData, (pData[0] << 8) | pData[1], (pData[2] << 8) | pData[3], int((rt - sp.tStart) / 10000i64),
+			m_bCustomPal, m_tridx, m_orgpal, m_cuspal, true);
+		m_img.nIdx = n;
+	}
+
+	return __super::Render(spd, bbox);
 }
 
 // IPersist
@@ -22,6 +22,12 @@
 #pragma once
 
 #include <atlcoll.h>
+#include <list>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 #include "VobSubImage.h"
 #include "SubPic/SubPicProviderImpl.h"
 
@@ -105,7 +111,61 @@ protected:
 	bool ReadIdx(CString fn, int& ver), ReadSub(CString fn), ReadRar(CString fn), ReadIfo(CString fn);
 	bool WriteIdx(CString fn), WriteSub(CString fn);
 
-	CMemFile m_sub;
+	// Read-only view of the mapped .sub file. An I/O error while reading the view
+	// is a short read, as with ReadFile, instead of an EXCEPTION_IN_PAGE_ERROR.
+	class CSubView : public CMemFile
+	{
+	public:
+		UINT Read(void* lpBuf, UINT nCount) override;
+	};
+
+	CMemFile m_sub;		// made in memory when unpacked from a rar, copied or ripped
+	CSubView m_subView;
+	HANDLE m_hSubMapping = nullptr;
+	void UnmapSub();
+	CFile& GetSubData() { return m_subView.GetLength() ? (CFile&)m_subView : (CFile&)m_sub; }
+	std::mutex m_mutexSub; // GetPacket and the prefetch thread share the read position of the sub data
+
+	// Decoded images of the subtitles that aren't animated, the most recently used first
+	struct DecodedPalette {
+		bool bCustomPal;
+		int tridx;
+		RGBQUAD cuspal[4];
+
+		bool operator == (const DecodedPalette& p) const {
+			return bCustomPal == p.bCustomPal && tridx == p.tridx && !memcmp(cuspal, p.cuspal, sizeof(cuspal));
+		}
+	};
+	struct DecodedImage {
+		int nLang;
+		size_t nIdx;
+		DecodedPalette palette;
+		CRect rect;
+		bool bForced;
+		CVobSubImage::SubPal pal[4];
+		std::vector<RGBQUAD> pixels;
+	};
+	std::list<std::shared_ptr<DecodedImage>> m_decodedImages;
+	size_t m_decodedBytes = 0;
+	std::shared_ptr<DecodedImage> m_pCurImage; // used by m_img
+	std::mutex m_mutexDecoded; // to protect the decoded images and the prefetch request
+
+	DecodedPalette GetDecodedPalette() const;
+	std::shared_ptr<DecodedImage> FindDecodedImage(int nLang, size_t idx, const DecodedPalette& palette);
+	void AddDecodedImage(const CVobSubImage& img, int nLang, size_t idx, const DecodedPalette& palette);
+	void ClearDecodedImages();
+
+	// Decodes the images following the shown one on a worker thread
+	std::thread m_prefetchThread;
+	std::condition_variable m_condPrefetch;
+	bool m_bPrefetchRequest = false, m_bExitPrefetch = false;
+	int m_nPrefetchLang = -1;
+	size_t m_nPrefetchIdx = 0;
+	DecodedPalette m_prefetchPalette = {};
+
+	void RequestPrefetch(int nLang, size_t idx);
+	void StopPrefetch();
+	void PrefetchImages();
 
 	BYTE* GetPacket(size_t idx, int& packetsize, int& datasize, int nLang = -1);
 	const SubPos* GetFrameInfo(size_t idx, int iLang = -1) const;
@@ -113,6 +173,19 @@ protected:
 	bool GetFrameByTimeStamp(__int64 time);
 	int GetFrameIdxByTimeStamp(__int64 time);
 
+	// Subpicture prepared for the export by a worker thread
+	struct ExportImage {
+		bool bValid = false;
+		CRect rect;
+		CVobSubImage::SubPal pal[4];
+		std::vector<BYTE> bitmap; // contents of the bmp file
+	};
+	// Decodes the subpictures of the current language and calls process on a pool of worker threads,
+	// write is called on the calling thread in the order of the subpictures,
+	// an exception thrown on a worker thread is rethrown by the calling thread
+	void ExportImages(std::function<void(const CVobSubImage& img, ExportImage& image)> process,
+					  std::function<void(size_t idx, const ExportImage& image)> write);
+
 	bool SaveVobSub(CString fn);
 	bool SaveWinSubMux(CString fn);
 	bool SaveScenarist(CString fn);
@@ -122,6 +195,19 @@ public:
 	int m_nLang;
 	SubLang m_langs[32];
 
+	// the number of images decoded ahead, 0 disables the prefetch thread
+	int m_nPrefetchImages = 2;
+	static const size_t MAX_DECODED_BYTES = 16 * 1024 * 1024;
+
+	// called by Save after each subpicture exported as a bitmap,
+	// with the number of processed subpictures, their total and the images per second
+	std::function<void(size_t done, size_t total, double rate)> m_fnExportProgress;
+	// the number of threads exporting bitmaps, 0 uses one per processor (up to 16)
+	size_t m_nExportThreads = 0;
+
+	// Stretches a synthetic subpicture of srcsize to dstsize nFrames times, returns the frames per second
+	static double BenchmarkStretch(CSize srcsize, CSize dstsize, int nFrames);
+
 	CVobSubFile(CCritSec* pLock);
 	virtual ~CVobSubFile();
 
@@ -175,11 +261,22 @@ class __declspec(uuid("D7FBFB45-2D13-494F-9B3D-FFC9557D5C45"))
 		REFERENCE_TIME tStart, tStop;
 		bool bAnimated;
 		bool bForced;
-		CAtlArray<BYTE> pData;
+		std::vector<BYTE> pData;
 	};
-	CAutoPtrList<SubPic> m_subpics;
+	// Ordered by tStart, a POSITION is the sequence number of the subpicture plus one
+	// so it stays valid when older subpictures are released
+	std::deque<SubPic> m_subpics;
+	size_t m_nFirstSubPic = 0; // sequence number of m_subpics.front()
+
+	const SubPic* GetSubPic(POSITION pos) const;
+	size_t FindSubPic(REFERENCE_TIME rt) const;
+	void CleanOld(REFERENCE_TIME rt);
 
 public:
+	// subpictures which ended this long before the rendered time are released,
+	// the input pin delivers them again after a seek
+	REFERENCE_TIME m_rtRetainBehind = 60 * 10000000i64;
+
 	CVobSubStream(CCritSec* pLock);
 	virtual ~CVobSubStream();
 
@@ -40,6 +40,7 @@ CDirectVobSub::CDirectVobSub()
 	m_iSelectedLanguage = 0;
 	m_bHideSubtitles         = theApp.GetProfileBool(IDS_R_GENERAL, IDS_RG_HIDE, false);
 	m_uSubPictToBuffer       = theApp.GetProfileInt(IDS_R_GENERAL, IDS_RG_SUBPICTTOBUFFER, 10);
+	m_uRenderingCacheSize    = std::clamp(theApp.GetProfileInt(IDS_R_GENERAL, IDS_RG_RENDERINGCACHESIZE, 128), 16u, 2048u);
 	m_bAnimWhenBuffering     = theApp.GetProfileBool(IDS_R_GENERAL, IDS_RG_ANIMWHENBUFFERING, true);
 	m_bAllowDropSubPic       = theApp.GetProfileBool(IDS_R_GENERAL, IDS_RG_ALLOW_DROPPING_SUBPIC, true);
 	m_bOverridePlacement     = theApp.GetProfileBool(IDS_R_TEXT, ResStr(IDS_RT_OVERRIDEPLACEMENT), false);
@@ -558,6 +559,7 @@ STDMETHODIMP CDirectVobSub::UpdateRegistry()
 
 	theApp.WriteProfileBool(IDS_R_GENERAL, IDS_RG_HIDE, m_bHideSubtitles);
 	theApp.WriteProfileInt(IDS_R_GENERAL, IDS_RG_SUBPICTTOBUFFER, m_uSubPictToBuffer);
+	theApp.WriteProfileInt(IDS_R_GENERAL, IDS_RG_RENDERINGCACHESIZE, m_uRenderingCacheSize);
 	theApp.WriteProfileBool(IDS_R_GENERAL, IDS_RG_ANIMWHENBUFFERING, m_bAnimWhenBuffering);
 	theApp.WriteProfileBool(IDS_R_GENERAL, IDS_RG_ALLOW_DROPPING_SUBPIC, m_bAllowDropSubPic);
 	theApp.WriteProfileBool(IDS_R_TEXT, ResStr(IDS_RT_OVERRIDEPLACEMENT), m_bOverridePlacement);
@@ -808,6 +810,29 @@ STDMETHODIMP CDirectVobSub::put_AspectRatioSettings(CSimpleTextSubtitle::EPARCom
 	return S_OK;
 }
 
+// IDirectVobSub4
+
+STDMETHODIMP CDirectVobSub::get_RenderingCacheSize(unsigned int* uSizeMB)
+{
+	CAutoLock cAutoLock(&m_propsLock);
+
+	return uSizeMB ? *uSizeMB = m_uRenderingCacheSize, S_OK : E_POINTER;
+}
+
+STDMETHODIMP CDirectVobSub::put_RenderingCacheSize(unsigned int uSizeMB)
+{
+	CAutoLock cAutoLock(&m_propsLock);
+
+	uSizeMB = std::clamp(uSizeMB, 16u, 2048u);
+	if (m_uRenderingCacheSize == uSizeMB) {
+		return S_FALSE;
+	}
+
+	m_uRenderingCacheSize = uSizeMB;
+
+	return S_OK;
+}
+
 // IFilterVersion
 
 STDMETHODIMP_(DWORD) CDirectVobSub::GetFilterVersion()
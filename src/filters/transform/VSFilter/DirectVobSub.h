@@ -26,7 +26,7 @@
 
 class CDirectVobSub
 	: public IDirectVobSub2
-	, public IDirectVobSub3
+	, public IDirectVobSub4
 	, public IFilterVersion
 {
 protected:
@@ -40,6 +40,7 @@ protected:
 	int m_iSelectedLanguage;
 	bool m_bHideSubtitles;
 	unsigned int m_uSubPictToBuffer;
+	unsigned int m_uRenderingCacheSize;
 	bool m_bAnimWhenBuffering;
 	bool m_bAllowDropSubPic;
 	bool m_bOverridePlacement;
@@ -142,6 +143,11 @@ public:
 		return E_NOTIMPL;
 	}
 
+	// IDirectVobSub4
+
+	STDMETHODIMP get_RenderingCacheSize(unsigned int* uSizeMB);
+	STDMETHODIMP put_RenderingCacheSize(unsigned int uSizeMB);
+
 	// IFilterVersion
 
 	STDMETHODIMP_(DWORD) GetFilterVersion();
@@ -275,6 +275,8 @@ STDMETHODIMP CDirectVobSubFilter::NonDelegatingQueryInterface(REFIID riid, void*
 		QI(IDirectVobSub)
 		QI(IDirectVobSub2)
 		QI(IDirectVobSub3)
+		QI(IDirectVobSub4)
+		QI(IDirectVobSubStats)
 		QI(IFilterVersion)
 		QI(ISpecifyPropertyPages)
 		QI(IAMStreamSelect)
@@ -359,6 +361,29 @@ HRESULT CDirectVobSubFilter::CopyBuffer(BYTE* pOut, BYTE* pIn, int w, int h, int
 	return S_OK;
 }
 
+bool CDirectVobSubFilter::CanBlendInPlace(IMediaSample* pIn, IMediaSample* pOut, const BITMAPINFOHEADER& bihIn, const BITMAPINFOHEADER& bihOut, bool fFlip)
+{
+	if (fFlip || !m_nTempPicBuffSize
+			|| m_pInput->CurrentMediaType().subtype != m_pOutput->CurrentMediaType().subtype) {
+		return false;
+	}
+
+	// no letterboxing or Scale2x
+	if (m_wout != bihIn.biWidth || m_hout != std::abs(bihIn.biHeight)) {
+		return false;
+	}
+
+	// the same layout and stride on both sides
+	if (bihOut.biCompression != bihIn.biCompression || bihOut.biBitCount != bihIn.biBitCount
+			|| bihOut.biWidth != bihIn.biWidth || std::abs(bihOut.biHeight) != std::abs(bihIn.biHeight)
+			|| m_spd.pitch != bihIn.biWidth * m_pInputVFormat->packsize) {
+		return false;
+	}
+
+	return (size_t)pIn->GetActualDataLength() >= m_nTempPicBuffSize
+		&& (size_t)pOut->GetSize() >= m_nTempPicBuffSize;
+}
+
 void CDirectVobSubFilter::GetOutputFormats(int& nNumber, VFormatDesc** ppFormats)
 {
 	nNumber    = m_VideoOutputFormats.size();
@@ -442,40 +467,6 @@ HRESULT CDirectVobSubFilter::Transform(IMediaSample* pIn)
 	BITMAPINFOHEADER bihIn;
 	ExtractBIH(&mtInput, &bihIn);
 
-	CSize sub(m_wout, m_hout);
-	CSize in(bihIn.biWidth, std::abs(bihIn.biHeight));
-
-	CopyPlane(m_pTempPicBuff.get(), pDataIn, sub, in, m_black);
-
-	auto& packsize = m_pInputVFormat->packsize;
-
-	if (m_pInputVFormat->planes == 2) {
-		BYTE* pSubUV = m_pTempPicBuff.get() + (sub.cx * packsize) * sub.cy;
-		BYTE* pInUV = pDataIn + (in.cx * packsize) * in.cy;
-
-		if (m_pInputVFormat->cmodel == Cm_YUV420) {
-			sub.cy >>= 1;
-			in.cy >>= 1;
-			CopyPlane(pSubUV, pInUV, sub, in, m_blackUV);
-		}
-	}
-	else if (m_pInputVFormat->planes == 3) {
-		BYTE* pSub2 = m_pTempPicBuff.get() + (sub.cx * packsize) * sub.cy;
-		BYTE* pIn2  = pDataIn + (in.cx * packsize) * in.cy;
-
-		if (m_pInputVFormat->cmodel == Cm_YUV420) {
-			sub.cx >>= 1;
-			sub.cy >>= 1;
-			in.cx >>= 1;
-			in.cy >>= 1;
-			BYTE* pSub3 = pSub2 + (sub.cx * packsize) * sub.cy;
-			BYTE* pIn3 = pIn2 + (in.cx * packsize) * in.cy;
-
-			CopyPlane(pSub2, pIn2, sub, in, m_blackUV);
-			CopyPlane(pSub3, pIn3, sub, in, m_blackUV);
-		}
-	}
-
 	DXVA2_ExtendedFormat dxvaExtFormat;
 	dxvaExtFormat.value = GetExColorInfo(&mtInput);
 
@@ -519,6 +510,48 @@ HRESULT CDirectVobSubFilter::Transform(IMediaSample* pIn)
 	//	fFlipSub = !fFlipSub;
 	//}
 
+	// When the output sample has the same layout as the input one, the input frame is copied
+	// into the output sample once and the subtitles are blended there, skipping the temp buffer
+	const bool bInPlace = CanBlendInPlace(pIn, pOut, bihIn, bihOut, fFlip);
+	if (bInPlace) {
+		memcpy(pDataOut, pDataIn, m_nTempPicBuffSize);
+		spd.bits = pDataOut;
+	} else {
+		CSize sub(m_wout, m_hout);
+		CSize in(bihIn.biWidth, std::abs(bihIn.biHeight));
+
+		CopyPlane(m_pTempPicBuff.get(), pDataIn, sub, in, m_black);
+
+		auto& packsize = m_pInputVFormat->packsize;
+
+		if (m_pInputVFormat->planes == 2) {
+			BYTE* pSubUV = m_pTempPicBuff.get() + (sub.cx * packsize) * sub.cy;
+			BYTE* pInUV = pDataIn + (in.cx * packsize) * in.cy;
+
+			if (m_pInputVFormat->cmodel == Cm_YUV420) {
+				sub.cy >>= 1;
+				in.cy >>= 1;
+				CopyPlane(pSubUV, pInUV, sub, in, m_blackUV);
+			}
+		}
+		else if (m_pInputVFormat->planes == 3) {
+			BYTE* pSub2 = m_pTempPicBuff.get() + (sub.cx * packsize) * sub.cy;
+			BYTE* pIn2  = pDataIn + (in.cx * packsize) * in.cy;
+
+			if (m_pInputVFormat->cmodel == Cm_YUV420) {
+				sub.cx >>= 1;
+				sub.cy >>= 1;
+				in.cx >>= 1;
+				in.cy >>= 1;
+				BYTE* pSub3 = pSub2 + (sub.cx * packsize) * sub.cy;
+				BYTE* pIn3 = pIn2 + (in.cx * packsize) * in.cy;
+
+				CopyPlane(pSub2, pIn2, sub, in, m_blackUV);
+				CopyPlane(pSub3, pIn3, sub, in, m_blackUV);
+			}
+		}
+	}
+
 	{
 		CAutoLock cAutoLock(&m_csQueueLock);
 
@@ -537,7 +570,9 @@ HRESULT CDirectVobSubFilter::Transform(IMediaSample* pIn)
 		}
 	}
 
-	CopyBuffer(pDataOut, spd.bits, spd.w, abs(spd.h)*(fFlip?-1:1), spd.pitch, mtInput.subtype);
+	if (!bInPlace) {
+		CopyBuffer(pDataOut, spd.bits, spd.w, abs(spd.h)*(fFlip?-1:1), spd.pitch, mtInput.subtype);
+	}
 
 	{
 		// copy dwTypeSpecificFlags from input IMediaSample
@@ -1046,6 +1081,7 @@ void CDirectVobSubFilter::InitSubPicQueue()
 	}
 
 	m_pTempPicBuff.reset(new(std::nothrow) BYTE[picbufsize]);
+	m_nTempPicBuffSize = m_pTempPicBuff ? picbufsize : 0;
 	m_spd.bits = m_pTempPicBuff.get();
 
 	DXVA2_ExtendedFormat exfmt = {
@@ -1546,6 +1582,20 @@ STDMETHODIMP CDirectVobSubFilter::put_SubPictToBuffer(unsigned int uSubPictToBuf
 	return hr;
 }
 
+STDMETHODIMP CDirectVobSubFilter::put_RenderingCacheSize(unsigned int uSizeMB)
+{
+	HRESULT hr = CDirectVobSub::put_RenderingCacheSize(uSizeMB);
+
+	if (hr == NOERROR) {
+		CComPtr<ISubPicProvider> pSubPicProvider;
+		if (CRenderedTextSubtitle* pRTS = GetRenderedTextSubtitle(pSubPicProvider)) {
+			pRTS->SetRenderingCacheBudget(size_t(m_uRenderingCacheSize) << 20);
+		}
+	}
+
+	return hr;
+}
+
 STDMETHODIMP CDirectVobSubFilter::put_AnimWhenBuffering(bool fAnimWhenBuffering)
 {
 	HRESULT hr = CDirectVobSub::put_AnimWhenBuffering(fAnimWhenBuffering);
@@ -1715,6 +1765,135 @@ STDMETHODIMP CDirectVobSubFilter::get_LanguageType(int iLanguage, int* pType)
 }
 
 
+// IDirectVobSubStats
+
+static HRESULT AllocStatsName(LPCWSTR name, WCHAR** ppName)
+{
+	if (ppName) {
+		const size_t len = wcslen(name) + 1;
+		*ppName = (WCHAR*)CoTaskMemAlloc(len * sizeof(WCHAR));
+		if (!*ppName) {
+			return E_OUTOFMEMORY;
+		}
+		wcscpy_s(*ppName, len, name);
+	}
+
+	return S_OK;
+}
+
+STDMETHODIMP CDirectVobSubFilter::get_RasterizerStageCount(int* pCount)
+{
+	CheckPointer(pCount, E_POINTER);
+
+	if (!RASTERIZER_STATS) {
+		return E_NOTIMPL;
+	}
+
+	*pCount = RasterizerStats::STAGE_COUNT;
+
+	return S_OK;
+}
+
+STDMETHODIMP CDirectVobSubFilter::get_RasterizerStageStats(int iStage, WCHAR** ppName, unsigned __int64* pCalls, unsigned __int64* pBytes, unsigned __int64* pTicks)
+{
+	if (!RASTERIZER_STATS) {
+		return E_NOTIMPL;
+	}
+
+	if (iStage < 0 || iStage >= RasterizerStats::STAGE_COUNT) {
+		return E_INVALIDARG;
+	}
+
+	CComPtr<ISubPicProvider> pSubPicProvider;
+	CRenderedTextSubtitle* pRTS = GetRenderedTextSubtitle(pSubPicProvider);
+	if (!pRTS) {
+		return E_FAIL;
+	}
+
+	const RasterizerStats stats = pRTS->GetRasterizerStats();
+	const RasterizerStats::Counter& c = stats.stages[iStage];
+
+	if (pCalls) {
+		*pCalls = c.calls;
+	}
+	if (pBytes) {
+		*pBytes = c.bytes;
+	}
+	if (pTicks) {
+		*pTicks = c.ticks;
+	}
+
+	return AllocStatsName(RasterizerStats::GetStageName(iStage), ppName);
+}
+
+STDMETHODIMP CDirectVobSubFilter::get_RenderingCacheCount(int* pCount)
+{
+	CheckPointer(pCount, E_POINTER);
+
+	*pCount = RenderingCaches::CACHE_COUNT;
+
+	return S_OK;
+}
+
+STDMETHODIMP CDirectVobSubFilter::get_RenderingCacheStats(int iCache, WCHAR** ppName, unsigned __int64* pEntries, unsigned __int64* pBytes, unsigned __int64* pHits, unsigned __int64* pMisses, unsigned __int64* pEvictions)
+{
+	if (iCache < 0 || iCache >= RenderingCaches::CACHE_COUNT) {
+		return E_INVALIDARG;
+	}
+
+	CComPtr<ISubPicProvider> pSubPicProvider;
+	CRenderedTextSubtitle* pRTS = GetRenderedTextSubtitle(pSubPicProvider);
+	if (!pRTS) {
+		return E_FAIL;
+	}
+
+	const CRenderingCacheStats stats = pRTS->GetRenderingCacheStats(iCache);
+
+	if (pEntries) {
+		*pEntries = stats.count;
+	}
+	if (pBytes) {
+		*pBytes = stats.bytes;
+	}
+	if (pHits) {
+		*pHits = stats.hits;
+	}
+	if (pMisses) {
+		*pMisses = stats.misses;
+	}
+	if (pEvictions) {
+		*pEvictions = stats.evictions;
+	}
+
+	return AllocStatsName(RenderingCaches::GetName(iCache), ppName);
+}
+
+STDMETHODIMP CDirectVobSubFilter::ResetStats()
+{
+	CComPtr<ISubPicProvider> pSubPicProvider;
+	CRenderedTextSubtitle* pRTS = GetRenderedTextSubtitle(pSubPicProvider);
+	if (!pRTS) {
+		return E_FAIL;
+	}
+
+	pRTS->ResetStats();
+
+	return S_OK;
+}
+
+STDMETHODIMP CDirectVobSubFilter::DumpStats()
+{
+	CComPtr<ISubPicProvider> pSubPicProvider;
+	CRenderedTextSubtitle* pRTS = GetRenderedTextSubtitle(pSubPicProvider);
+	if (!pRTS) {
+		return E_FAIL;
+	}
+
+	pRTS->DumpStats();
+
+	return S_OK;
+}
+
 // IDirectVobSubFilterColor
 
 STDMETHODIMP CDirectVobSubFilter::HasConfigDialog(int iSelected)
@@ -2174,6 +2353,7 @@ void CDirectVobSubFilter::SetSubtitle(ISubStream* pSubStream, bool fApplyDefStyl
 			}
 
 			pRTS->m_ePARCompensationType = m_ePARCompensationType;
+			pRTS->SetRenderingCacheBudget(size_t(m_uRenderingCacheSize) << 20);
 			if (m_CurrentVIH2.dwPictAspectRatioX != 0 && m_CurrentVIH2.dwPictAspectRatioY != 0&& m_CurrentVIH2.bmiHeader.biWidth != 0 && m_CurrentVIH2.bmiHeader.biHeight != 0) {
 				pRTS->m_dPARCompensation = ((double)abs(m_CurrentVIH2.bmiHeader.biWidth) / (double)abs(m_CurrentVIH2.bmiHeader.biHeight)) /
 										   ((double)abs((long)m_CurrentVIH2.dwPictAspectRatioX) / (double)abs((long)m_CurrentVIH2.dwPictAspectRatioY));
@@ -2220,6 +2400,18 @@ void CDirectVobSubFilter::SetSubtitle(ISubStream* pSubStream, bool fApplyDefStyl
 	}
 }
 
+// Returns the current subtitle if it's a text one, pSubPicProvider keeps it alive
+CRenderedTextSubtitle* CDirectVobSubFilter::GetRenderedTextSubtitle(CComPtr<ISubPicProvider>& pSubPicProvider)
+{
+	CAutoLock cAutolock(&m_csQueueLock);
+
+	if (!m_pSubPicQueue || FAILED(m_pSubPicQueue->GetSubPicProvider(&pSubPicProvider)) || !pSubPicProvider) {
+		return nullptr;
+	}
+
+	return dynamic_cast<CRenderedTextSubtitle*>((ISubPicProvider*)pSubPicProvider);
+}
+
 void CDirectVobSubFilter::InvalidateSubtitle(REFERENCE_TIME rtInvalidate, DWORD_PTR nSubtitleId)
 {
 	CAutoLock cAutolock(&m_csQueueLock);
@@ -29,6 +29,8 @@
 #include "SubPic/ISubPic.h"
 #include "Scale2x.h"
 
+class CRenderedTextSubtitle;
+
 struct SystrayIconData {
 	HWND hSystrayWnd;
 	IFilterGraph* graph;
@@ -65,6 +67,7 @@ class __declspec(uuid("93A22E7A-5091-45ef-BA61-6DA26156A5D0"))
 	, public CDirectVobSub
 	, public ISpecifyPropertyPages
 	, public IAMStreamSelect
+	, public IDirectVobSubStats
 	, public CAMThread
 {
 	friend class CTextInputPin;
@@ -144,6 +147,17 @@ public:
 	// IDirectVobSub3
 	STDMETHODIMP get_LanguageType(int iLanguage, int* pType);
 
+	// IDirectVobSub4
+	STDMETHODIMP put_RenderingCacheSize(unsigned int uSizeMB);
+
+	// IDirectVobSubStats
+	STDMETHODIMP get_RasterizerStageCount(int* pCount);
+	STDMETHODIMP get_RasterizerStageStats(int iStage, WCHAR** ppName, unsigned __int64* pCalls, unsigned __int64* pBytes, unsigned __int64* pTicks);
+	STDMETHODIMP get_RenderingCacheCount(int* pCount);
+	STDMETHODIMP get_RenderingCacheStats(int iCache, WCHAR** ppName, unsigned __int64* pEntries, unsigned __int64* pBytes, unsigned __int64* pHits, unsigned __int64* pMisses, unsigned __int64* pEvictions);
+	STDMETHODIMP ResetStats();
+	STDMETHODIMP DumpStats();
+
 	// ISpecifyPropertyPages
 	STDMETHODIMP GetPages(CAUUID* pPages);
 
@@ -165,7 +179,9 @@ protected:
 
 	/* ResX2 */
 	std::unique_ptr<BYTE> m_pTempPicBuff;
+	size_t m_nTempPicBuffSize = 0;
 	void CopyPlane(BYTE* pSub, BYTE* pIn, CSize sub, CSize in, uint32_t black);
+	bool CanBlendInPlace(IMediaSample* pIn, IMediaSample* pOut, const BITMAPINFOHEADER& bihIn, const BITMAPINFOHEADER& bihOut, bool fFlip);
 
 	// segment start time, absolute time
 	CRefTime m_tPrev;
@@ -189,6 +205,7 @@ protected:
 	void UpdateSubtitle(bool fApplyDefStyle = true);
 	void SetSubtitle(ISubStream* pSubStream, bool fApplyDefStyle = true);
 	void InvalidateSubtitle(REFERENCE_TIME rtInvalidate = -1, DWORD_PTR nSubtitleId = -1);
+	CRenderedTextSubtitle* GetRenderedTextSubtitle(CComPtr<ISubPicProvider>& pSubPicProvider);
 
 	// the text input pin is using these
 	void AddSubStream(ISubStream* pSubStream);
@@ -324,6 +324,24 @@ IDirectVobSub2 :
 		STDMETHOD(get_LanguageType)(int iLanguage, int* pType /* 0 - Embedded, 1 - External */) PURE;
 	};
 
+	interface __declspec(uuid("C0002F92-E05C-4566-B056-43CAE43F2A00")) IDirectVobSub4 : public IDirectVobSub3
+	{
+		STDMETHOD(get_RenderingCacheSize)(unsigned int* uSizeMB) PURE;
+		STDMETHOD(put_RenderingCacheSize)(unsigned int uSizeMB /* memory budget of the text rendering caches */) PURE;
+	};
+
+	// Profiling counters of the current text subtitle.
+	// The rasterizer stages are only counted when the filter is built with RASTERIZER_STATS, E_NOTIMPL otherwise.
+	interface __declspec(uuid("1BE6CF08-384D-4408-9EF7-FC4CD3D57506")) IDirectVobSubStats : public IUnknown
+	{
+		STDMETHOD(get_RasterizerStageCount)(int* pCount) PURE;
+		STDMETHOD(get_RasterizerStageStats)(int iStage, WCHAR** ppName, unsigned __int64* pCalls, unsigned __int64* pBytes, unsigned __int64* pTicks) PURE;
+		STDMETHOD(get_RenderingCacheCount)(int* pCount) PURE;
+		STDMETHOD(get_RenderingCacheStats)(int iCache, WCHAR** ppName, unsigned __int64* pEntries, unsigned __int64* pBytes, unsigned __int64* pHits, unsigned __int64* pMisses, unsigned __int64* pEvictions) PURE;
+		STDMETHOD(ResetStats)() PURE;
+		STDMETHOD(DumpStats)() PURE; // writes the counters to the log
+	};
+
 #ifdef __cplusplus
 }
 #endif
@@ -41,6 +41,7 @@
 #define IDS_RG_RESX2MINW             L"ResX2MinWidth"
 #define IDS_RG_RESX2MINH             L"ResX2MinHeight"
 #define IDS_RG_SUBPICTTOBUFFER       L"SubPictToBuffer"
+#define IDS_RG_RENDERINGCACHESIZE    L"RenderingCacheSize"
 #define IDS_RG_ANIMWHENBUFFERING     L"AnimWhenBuffering"
 #define IDS_RG_ALLOW_DROPPING_SUBPIC L"AllowDropSubPic"
 #define IDS_RG_EXTERNALLOAD          L"ExtLoad"
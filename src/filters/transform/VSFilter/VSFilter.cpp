@@ -20,11 +20,18 @@
  */
 
 #include "stdafx.h"
+#include <chrono>
+#include <numeric>
 #include "DirectVobSubFilter.h"
 #include "DirectVobSubPropPage.h"
 #include "VSFilter.h"
+#include "vfr.h"
 #include <moreuuids.h>
 #include "SettingsDefines.h"
+#include "SubPic/MemSubPic.h"
+#include "Subtitles/RTS.h"
+#include "Subtitles/TextFile.h"
+#include "Subtitles/VobSubFile.h"
 
 /////////////////////////////////////////////////////////////////////////////
 // CVSFilterApp
@@ -181,3 +188,494 @@ void CALLBACK DirectVobSub(HWND hwnd, HINSTANCE hinst, LPSTR lpszCmdLine, int nC
 
 	::CoUninitialize();
 }
+
+static void ReportToConsole(HWND hwnd, LPCWSTR title, const CStringW& str)
+{
+	// rundll32 has no console, the output goes to the one it was started from
+	if (::AttachConsole(ATTACH_PARENT_PROCESS)) {
+		HANDLE hConsole = ::CreateFileW(L"CONOUT$", GENERIC_WRITE, FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (hConsole != INVALID_HANDLE_VALUE) {
+			DWORD written = 0;
+			::WriteConsoleW(hConsole, str.GetString(), str.GetLength(), &written, nullptr);
+			::CloseHandle(hConsole);
+		}
+		::FreeConsole();
+	} else {
+		::MessageBoxW(hwnd, str, title, MB_OK);
+	}
+}
+
+// reads the files written by CVobSubFile::Save for fn, they all start with its name
+static void ReadVobSubExport(const CString& fn, std::map<CString, std::vector<BYTE>>& files)
+{
+	files.clear();
+
+	const CString dir = fn.Left(std::max(fn.ReverseFind('\\'), fn.ReverseFind('/')) + 1);
+
+	WIN32_FIND_DATAW fd;
+	HANDLE hFind = ::FindFirstFileW(fn + L"*", &fd);
+	if (hFind == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	do {
+		if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			continue;
+		}
+
+		CFile f;
+		if (f.Open(dir + fd.cFileName, CFile::modeRead|CFile::typeBinary|CFile::shareDenyNone)) {
+			std::vector<BYTE>& data = files[fd.cFileName];
+			data.resize((size_t)f.GetLength());
+			if (!data.empty()) {
+				f.Read(data.data(), (UINT)data.size());
+			}
+		}
+	} while (::FindNextFileW(hFind, &fd));
+
+	::FindClose(hFind);
+}
+
+// Exports a VobSub subtitle and reports the number of images per second.
+//   start /wait rundll32 VSFilter.dll,VobSubExport <input.idx> <output without extension> [vobsub|winsubmux|scenarist|maestro] [/verify]
+// /verify exports it again on a single thread and compares the files byte for byte.
+// rundll32 calls this W version of VobSubExport with the command line in Unicode.
+void CALLBACK VobSubExportW(HWND hwnd, HINSTANCE hinst, LPWSTR lpszCmdLine, int nCmdShow)
+{
+	std::vector<CString> args;
+	bool bVerify = false;
+	CVobSubFile::SubFormat sf = CVobSubFile::WinSubMux;
+
+	int argc = 0;
+	LPWSTR* argv = lpszCmdLine && *lpszCmdLine ? ::CommandLineToArgvW(lpszCmdLine, &argc) : nullptr;
+	for (int i = 0; i < argc; i++) {
+		CString arg(argv[i]);
+		if (arg.CompareNoCase(L"/verify") == 0) {
+			bVerify = true;
+		} else if (args.size() == 2) {
+			arg.MakeLower();
+			sf = arg == L"vobsub" ? CVobSubFile::VobSub
+				 : arg == L"scenarist" ? CVobSubFile::Scenarist
+				 : arg == L"maestro" ? CVobSubFile::Maestro
+				 : CVobSubFile::WinSubMux;
+		} else {
+			args.emplace_back(arg);
+		}
+	}
+	if (argv) {
+		::LocalFree(argv);
+	}
+
+	if (args.size() < 2) {
+		ReportToConsole(hwnd, L"VobSubExport", L"Usage: rundll32 VSFilter.dll,VobSubExport <input.idx> <output without extension> [vobsub|winsubmux|scenarist|maestro] [/verify]\n");
+		return;
+	}
+
+	CStringW report;
+
+	try {
+		CVobSubFile vsf(nullptr);
+		if (!vsf.Open(args[0])) {
+			ReportToConsole(hwnd, L"VobSubExport", L"Can't open " + args[0] + L"\n");
+			return;
+		}
+
+		size_t total = 0;
+		double rate = 0.0;
+		vsf.m_fnExportProgress = [&](size_t done, size_t count, double r) {
+			total = count;
+			rate = r;
+		};
+
+		const auto start = std::chrono::steady_clock::now();
+		const bool bSaved = vsf.Save(args[1], sf);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		if (!bSaved) {
+			ReportToConsole(hwnd, L"VobSubExport", L"Can't save " + args[1] + L"\n");
+			return;
+		}
+
+		CStringW str;
+		str.Format(L"Exported %Iu images in %.3f s, %.1f images/s\n", total, seconds, rate);
+		report += str;
+
+		if (bVerify) {
+			std::map<CString, std::vector<BYTE>> parallel, sequential;
+			ReadVobSubExport(args[1], parallel);
+
+			vsf.m_nExportThreads = 1;
+			vsf.Save(args[1], sf);
+			ReadVobSubExport(args[1], sequential);
+
+			str.Format(L"Single thread: %.1f images/s\n", rate);
+			report += str;
+
+			size_t nDiffs = 0;
+			for (const auto& [name, data] : sequential) {
+				const auto it = parallel.find(name);
+				if (it == parallel.end() || it->second != data) {
+					report += L"Differs: " + name + L"\n";
+					nDiffs++;
+				}
+			}
+			if (parallel.size() != sequential.size()) {
+				nDiffs++;
+			}
+
+			str.Format(nDiffs ? L"%Iu files, the outputs differ\n" : L"%Iu files, the outputs are identical\n", sequential.size());
+			report += str;
+		}
+	} catch (CException* e) {
+		WCHAR msg[1024] = {};
+		e->GetErrorMessage(msg, std::size(msg));
+		e->Delete();
+		report += L"Error: " + CStringW(msg) + L"\n";
+	} catch (const std::exception& e) {
+		report += L"Error: " + CStringW(e.what()) + L"\n";
+	}
+
+	ReportToConsole(hwnd, L"VobSubExport", report);
+}
+
+// ASS script of nLines events lasting 2 s and starting every second, so two lines are shown at any time
+static CStringA MakeBenchmarkScript(int nLines, LPCSTR tags = "")
+{
+	CStringA script =
+		"[Script Info]\n"
+		"ScriptType: v4.00+\n"
+		"PlayResX: 1920\n"
+		"PlayResY: 1080\n"
+		"\n"
+		"[V4+ Styles]\n"
+		"Format: Name, Fontname, Fontsize, PrimaryColour, SecondaryColour, OutlineColour, BackColour, Bold, Italic, Underline, StrikeOut, "
+		"ScaleX, ScaleY, Spacing, Angle, BorderStyle, Outline, Shadow, Alignment, MarginL, MarginR, MarginV, Encoding\n"
+		"Style: Default,Arial,60,&H00FFFFFF,&H000000FF,&H00000000,&H80000000,0,0,0,0,100,100,0,0,1,3,2,2,40,40,40,1\n"
+		"\n"
+		"[Events]\n"
+		"Format: Layer, Start, End, Style, Name, MarginL, MarginR, MarginV, Effect, Text\n";
+
+	for (int i = 0; i < nLines; i++) {
+		script.AppendFormat("Dialogue: 0,%d:%02d:%02d.00,%d:%02d:%02d.00,Default,,0,0,0,,%sLine %d of the benchmark script\n",
+							i / 3600, i / 60 % 60, i % 60, (i + 2) / 3600, (i + 2) / 60 % 60, (i + 2) % 60, tags, i);
+	}
+
+	return script;
+}
+
+// Renders each time into a clear RGB32 frame and returns the milliseconds of each render
+static std::vector<double> RenderBenchmarkFrames(CRenderedTextSubtitle& rts, CSize size, const std::vector<REFERENCE_TIME>& times, double fps = 25.0)
+{
+	std::vector<DWORD> frame((size_t)size.cx * size.cy);
+
+	SubPicDesc spd;
+	spd.type = MSP_RGB32;
+	spd.w = size.cx;
+	spd.h = size.cy;
+	spd.bpp = 32;
+	spd.pitch = size.cx * 4;
+	spd.bits = (BYTE*)frame.data();
+	spd.vidrect = {0, 0, size.cx, size.cy};
+
+	std::vector<double> ms;
+	ms.reserve(times.size());
+
+	for (const REFERENCE_TIME rt : times) {
+		std::fill(frame.begin(), frame.end(), 0xFF000000);
+
+		RECT bbox;
+		const auto start = std::chrono::steady_clock::now();
+		rts.Render(spd, rt, fps, bbox);
+		ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+
+	return ms;
+}
+
+// MB/s of CTextFile::ReadString on about 32 MB of UTF-8 text made of the line repeated
+static double BenchmarkReadUtf8(LPCWSTR line)
+{
+	const CStringA utf8 = CStringA(CW2A(line, CP_UTF8)) + "\r\n";
+
+	CStringA text = "\xEF\xBB\xBF";
+	const int nLines = 32 * 1024 * 1024 / utf8.GetLength();
+	text.Preallocate(3 + nLines * utf8.GetLength());
+	for (int i = 0; i < nLines; i++) {
+		text += utf8;
+	}
+
+	CTextFile f;
+	if (!f.Open((const BYTE*)text.GetString(), text.GetLength()) || f.GetEncoding() != CP_UTF8) {
+		return 0.0;
+	}
+
+	CStringW str;
+	const auto start = std::chrono::steady_clock::now();
+	while (f.ReadString(str)) {
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	return seconds > 0.0 ? text.GetLength() / seconds / (1024 * 1024) : 0.0;
+}
+
+// Measures parts of the renderer on synthetic input, all of them without a switch.
+//   start /wait rundll32 VSFilter.dll,Benchmark [/stretch] [/blend] [/timecodes] [/seek] [/load] [/utf8] [/blur]
+// /stretch: StretchBlt of a 720x576 VobSub subpicture to 3840x2160
+// /blend: each RGB32 alpha blend kernel of CMemSubPic over a 3840x2160 frame
+// /timecodes: frame/time lookups of the VFR translators on v1 and v2 files with 10^5 lines
+// /seek: renders at random times of a 50000 line script
+// /load: parsing of scripts with 10^4, 10^5 and 10^6 lines
+// /utf8: decoding of ASCII, cyrillic and japanese UTF-8 text
+// /blur: renders of new lines with \blur2, \blur10 and \blur40
+// rundll32 calls this W version of Benchmark with the command line in Unicode.
+void CALLBACK BenchmarkW(HWND hwnd, HINSTANCE hinst, LPWSTR lpszCmdLine, int nCmdShow)
+{
+	std::vector<CString> switches;
+
+	int argc = 0;
+	LPWSTR* argv = lpszCmdLine && *lpszCmdLine ? ::CommandLineToArgvW(lpszCmdLine, &argc) : nullptr;
+	for (int i = 0; i < argc; i++) {
+		switches.emplace_back(CString(argv[i]).MakeLower());
+	}
+	if (argv) {
+		::LocalFree(argv);
+	}
+
+	auto selected = [&](LPCWSTR name) {
+		return switches.empty() || std::find(switches.begin(), switches.end(), name) != switches.end();
+	};
+
+	CStringW report;
+
+	try {
+		if (selected(L"/stretch")) {
+			const double fps = CVobSubFile::BenchmarkStretch(CSize(720, 576), CSize(3840, 2160), 50);
+
+			CStringW str;
+			str.Format(L"StretchBlt 720x576 -> 3840x2160: %.1f frames/s, %.2f ms/frame\n", fps, fps > 0.0 ? 1000.0 / fps : 0.0);
+			report += str;
+		}
+		if (selected(L"/blend")) {
+			for (int kernel = 0; kernel < CMemSubPic::BLEND_COUNT; kernel++) {
+				const double mpixs = CMemSubPic::BenchmarkAlphaBlt(kernel, CSize(3840, 2160), 50);
+
+				CStringW str;
+				if (mpixs > 0.0) {
+					str.Format(L"AlphaBlt RGB32 %-4s: %.1f MPix/s\n", CMemSubPic::GetAlphaBltName(kernel), mpixs);
+				} else {
+					str.Format(L"AlphaBlt RGB32 %-4s: not supported by the CPU\n", CMemSubPic::GetAlphaBltName(kernel));
+				}
+				report += str;
+			}
+		}
+		if (selected(L"/timecodes")) {
+			for (int version = 1; version <= 2; version++) {
+				const double rate = BenchmarkVFRTranslator(version, 100000, 1000000);
+
+				CStringW str;
+				str.Format(L"Timecodes v%d, 100000 lines: %.2f M round trips/s\n", version, rate / 1000000.0);
+				report += str;
+			}
+		}
+		if (selected(L"/seek")) {
+			const int nLines = 50000;
+			CStringA script = MakeBenchmarkScript(nLines);
+
+			CCritSec csLock;
+			std::unique_ptr<CRenderedTextSubtitle> pRTS(DNew CRenderedTextSubtitle(&csLock));
+			if (pRTS->Open((BYTE*)script.GetString(), script.GetLength(), CP_UTF8, L"Benchmark")) {
+				// far from each other, the cached subtitles of the previous time have all expired
+				std::vector<REFERENCE_TIME> times(2000);
+				unsigned seed = 1;
+				for (auto& rt : times) {
+					seed = seed * 1664525 + 1013904223;
+					rt = (REFERENCE_TIME)((seed >> 8) % (nLines * 1000)) * 10000;
+				}
+
+				const std::vector<double> ms = RenderBenchmarkFrames(*pRTS, CSize(1920, 1080), times);
+
+				CStringW str;
+				str.Format(L"Seek in %d lines: %.2f ms/render on average, %.2f ms at most\n",
+						   nLines, std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size(), *std::max_element(ms.begin(), ms.end()));
+				report += str;
+			} else {
+				report += L"Seek: can't open the script\n";
+			}
+		}
+		if (selected(L"/load")) {
+			for (const int nLines : { 10000, 100000, 1000000 }) {
+				CStringA script = MakeBenchmarkScript(nLines);
+
+				CCritSec csLock;
+				std::unique_ptr<CRenderedTextSubtitle> pRTS(DNew CRenderedTextSubtitle(&csLock));
+
+				const auto start = std::chrono::steady_clock::now();
+				const bool bOpened = pRTS->Open((BYTE*)script.GetString(), script.GetLength(), CP_UTF8, L"Benchmark");
+				const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				CStringW str;
+				if (bOpened) {
+					str.Format(L"Load %d lines: %.3f s, %.0f lines/s\n", nLines, seconds, seconds > 0.0 ? nLines / seconds : 0.0);
+				} else {
+					str.Format(L"Load %d lines: can't open the script\n", nLines);
+				}
+				report += str;
+			}
+		}
+		if (selected(L"/utf8")) {
+			static const struct {
+				LPCWSTR name, line;
+			} texts[] = {
+				{ L"ASCII",    L"The quick brown fox jumps over the lazy dog, 0123456789." },
+				{ L"Cyrillic", L"\x0421\x044A\x0435\x0448\x044C \x0436\x0435 \x0435\x0449\x0451 \x044D\x0442\x0438\x0445 \x043C\x044F\x0433\x043A\x0438\x0445 "
+							   L"\x0444\x0440\x0430\x043D\x0446\x0443\x0437\x0441\x043A\x0438\x0445 \x0431\x0443\x043B\x043E\x043A" },
+				{ L"Japanese", L"\x65E5\x672C\x8A9E\x306E\x5B57\x5E55\x3092\x8AAD\x307F\x8FBC\x3080\x30C6\x30B9\x30C8\x3067\x3059\x3002" },
+			};
+
+			for (const auto& text : texts) {
+				CStringW str;
+				str.Format(L"UTF-8 %-8s: %.1f MB/s\n", text.name, BenchmarkReadUtf8(text.line));
+				report += str;
+			}
+		}
+		if (selected(L"/blur")) {
+			for (const int radius : { 2, 10, 40 }) {
+				CStringA tags;
+				tags.Format("{\\blur%d}", radius);
+				CStringA script = MakeBenchmarkScript(200, tags);
+
+				CCritSec csLock;
+				std::unique_ptr<CRenderedTextSubtitle> pRTS(DNew CRenderedTextSubtitle(&csLock));
+				if (!pRTS->Open((BYTE*)script.GetString(), script.GetLength(), CP_UTF8, L"Benchmark")) {
+					report += L"Blur: can't open the script\n";
+					break;
+				}
+
+				// every 2 s both lines shown are new and the words they share with the previous ones
+				// are evicted from the caches, so each render blurs all of them
+				pRTS->SetRenderingCacheBudget(1);
+
+				std::vector<REFERENCE_TIME> times;
+				for (int i = 0; i < 100; i++) {
+					times.emplace_back((REFERENCE_TIME)(i * 2000 + 500) * 10000);
+				}
+
+				const std::vector<double> ms = RenderBenchmarkFrames(*pRTS, CSize(1920, 1080), times);
+
+				CStringW str;
+				str.Format(L"Blur %2d, 2 lines at 1920x1080: %.2f ms/render\n", radius, std::accumulate(ms.begin(), ms.end(), 0.0) / ms.size());
+				report += str;
+			}
+		}
+	} catch (CException* e) {
+		WCHAR msg[1024] = {};
+		e->GetErrorMessage(msg, std::size(msg));
+		e->Delete();
+		report += L"Error: " + CStringW(msg) + L"\n";
+	} catch (const std::exception& e) {
+		report += L"Error: " + CStringW(e.what()) + L"\n";
+	}
+
+	ReportToConsole(hwnd, L"Benchmark", report);
+}
+
+// Renders a text subtitle script without a player and reports the time of each frame
+// with the counters of the rasterizer and of the rendering caches.
+//   start /wait rundll32 VSFilter.dll,RenderBenchmark <script> [width height] [frames]
+// The frames follow each other at 23.976 fps from the start of the first line, 1920x1080 and 1000 by default.
+// The rasterizer stages are only counted by builds with RASTERIZER_STATS.
+// rundll32 calls this W version of RenderBenchmark with the command line in Unicode.
+void CALLBACK RenderBenchmarkW(HWND hwnd, HINSTANCE hinst, LPWSTR lpszCmdLine, int nCmdShow)
+{
+	std::vector<CString> args;
+
+	int argc = 0;
+	LPWSTR* argv = lpszCmdLine && *lpszCmdLine ? ::CommandLineToArgvW(lpszCmdLine, &argc) : nullptr;
+	for (int i = 0; i < argc; i++) {
+		args.emplace_back(argv[i]);
+	}
+	if (argv) {
+		::LocalFree(argv);
+	}
+
+	if (args.empty()) {
+		ReportToConsole(hwnd, L"RenderBenchmark", L"Usage: rundll32 VSFilter.dll,RenderBenchmark <script> [width height] [frames]\n");
+		return;
+	}
+
+	CSize size(1920, 1080);
+	int nFrames = 1000;
+	if (args.size() >= 3) {
+		size.SetSize(_wtoi(args[1]), _wtoi(args[2]));
+	}
+	if (args.size() >= 4) {
+		nFrames = _wtoi(args[3]);
+	}
+	if (size.cx <= 0 || size.cy <= 0 || nFrames <= 0) {
+		ReportToConsole(hwnd, L"RenderBenchmark", L"Invalid size or number of frames\n");
+		return;
+	}
+
+	CStringW report;
+
+	try {
+		CCritSec csLock;
+		std::unique_ptr<CRenderedTextSubtitle> pRTS(DNew CRenderedTextSubtitle(&csLock));
+		if (!pRTS->Open(args[0], CP_ACP, true, L"", L"") || pRTS->IsEmpty()) {
+			ReportToConsole(hwnd, L"RenderBenchmark", L"Can't open " + args[0] + L"\n");
+			return;
+		}
+
+		int start = INT_MAX;
+		for (size_t i = 0; i < pRTS->GetCount(); i++) {
+			start = std::min(start, pRTS->GetAt(i).start);
+		}
+
+		const double fps = 24000.0 / 1001;
+		std::vector<REFERENCE_TIME> times(nFrames);
+		for (int i = 0; i < nFrames; i++) {
+			times[i] = (REFERENCE_TIME)start * 10000 + (REFERENCE_TIME)(i * 10000000 / fps);
+		}
+
+		pRTS->ResetStats();
+		std::vector<double> ms = RenderBenchmarkFrames(*pRTS, size, times, fps);
+
+		const double total = std::accumulate(ms.begin(), ms.end(), 0.0);
+		std::sort(ms.begin(), ms.end());
+		auto percentile = [&](int p) {
+			return ms[(ms.size() - 1) * p / 100];
+		};
+
+		CStringW str;
+		str.Format(L"%d frames at %dx%d: %.2f ms/frame on average, %.1f frames/s\n", nFrames, size.cx, size.cy, total / nFrames, total > 0.0 ? nFrames * 1000.0 / total : 0.0);
+		report += str;
+		str.Format(L"    p50: %.2f ms, p90: %.2f ms, p99: %.2f ms, max: %.2f ms\n", percentile(50), percentile(90), percentile(99), ms.back());
+		report += str;
+
+		const RasterizerStats rasterizerStats = pRTS->GetRasterizerStats();
+		report += L"Rasterizer:\n";
+		for (int i = 0; i < RasterizerStats::STAGE_COUNT; i++) {
+			const RasterizerStats::Counter& c = rasterizerStats.stages[i];
+			str.Format(L"    %-12s calls: %10I64u, bytes: %12I64u, ticks: %14I64u, ticks/call: %I64u\n",
+					   RasterizerStats::GetStageName(i), c.calls, c.bytes, c.ticks, c.calls ? c.ticks / c.calls : 0);
+			report += str;
+		}
+
+		report += L"Rendering caches:\n";
+		for (int i = 0; i < RenderingCaches::CACHE_COUNT; i++) {
+			const CRenderingCacheStats stats = pRTS->GetRenderingCacheStats(i);
+			str.Format(L"    %-12s entries: %6Iu, bytes: %10Iu, hits: %10I64u, misses: %10I64u, evictions: %10I64u\n",
+					   RenderingCaches::GetName(i), stats.count, stats.bytes, stats.hits, stats.misses, stats.evictions);
+			report += str;
+		}
+	} catch (CException* e) {
+		WCHAR msg[1024] = {};
+		e->GetErrorMessage(msg, std::size(msg));
+		e->Delete();
+		report += L"Error: " + CStringW(msg) + L"\n";
+	} catch (const std::exception& e) {
+		report += L"Error: " + CStringW(e.what()) + L"\n";
+	}
+
+	ReportToConsole(hwnd, L"RenderBenchmark", report);
+}
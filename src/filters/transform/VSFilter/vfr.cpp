@@ -25,9 +25,20 @@
 #include "vfr.h"
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
 
 // Work with seconds per frame (spf) here instead of fps since that's more natural for the translation we're doing
 
+// Number of whole frames in the duration, the epsilon makes the time stamp of a frame map back to the same frame
+// when the division lands just below an integer
+static int FramesInDuration(double duration, double spf)
+{
+	return (int)(duration / spf + 1e-6);
+}
+
 class TimecodesV1 : public VFRTranslator
 {
 private:
@@ -46,14 +57,46 @@ private:
 	};
 	std::vector<FrameRateSection> sections;
 
+	// The plugins mostly ask for consecutive frames, so remember the last section hit.
+	// It's only a hint, AviSynth MT can call GetFrame from several threads at once.
+	std::atomic<size_t> last_section = 0;
+
+	// Sections are generated in frame order, so binary search on the start frame
+	const FrameRateSection* FindSection(int n) {
+		const size_t last = last_section.load(std::memory_order_relaxed);
+		if (last < sections.size()) {
+			const FrameRateSection& sect = sections[last];
+			if (n >= sect.start_frame && n <= sect.end_frame) {
+				return &sect;
+			}
+			if (last + 1 < sections.size()) {
+				const FrameRateSection& next = sections[last + 1];
+				if (n >= next.start_frame && n <= next.end_frame) {
+					last_section.store(last + 1, std::memory_order_relaxed);
+					return &next;
+				}
+			}
+		}
+
+		auto it = std::upper_bound(sections.cbegin(), sections.cend(), n, [](int n, const FrameRateSection& sect) {
+			return n < sect.start_frame;
+		});
+		if (it != sections.cbegin()) {
+			--it;
+			if (n <= it->end_frame) {
+				last_section.store(it - sections.cbegin(), std::memory_order_relaxed);
+				return &(*it);
+			}
+		}
+
+		return nullptr;
+	}
+
 public:
 	virtual double TimeStampFromFrameNumber(int n) {
 		// Find correct section
-		for (size_t i = 0; i < sections.size(); i++) {
-			FrameRateSection &sect = sections[i];
-			if (n >= sect.start_frame && n <= sect.end_frame) {
-				return sect.start_time + (n - sect.start_frame) * sect.spf;
-			}
+		if (const FrameRateSection* sect = FindSection(n)) {
+			return sect->start_time + (n - sect->start_frame) * sect->spf;
 		}
 		// Not in a section
 		if (n < 0) {
@@ -62,6 +105,33 @@ public:
 		return first_non_section_timestamp + (n - first_non_section_frame) * default_spf;
 	}
 
+	virtual int FrameNumberFromTimeStamp(double t) {
+		if (t <= 0.0) {
+			return 0;
+		}
+
+		if (t < first_non_section_timestamp) {
+			auto it = std::upper_bound(sections.cbegin(), sections.cend(), t, [](double t, const FrameRateSection& sect) {
+				return t < sect.start_time;
+			});
+			if (it != sections.cbegin()) {
+				--it;
+				if (it->spf <= 0) {
+					return it->start_frame;
+				}
+				const int n = it->start_frame + FramesInDuration(t - it->start_time, it->spf);
+				return std::min(n, it->end_frame);
+			}
+			return 0;
+		}
+
+		// Not in a section
+		if (default_spf <= 0) {
+			return first_non_section_frame;
+		}
+		return first_non_section_frame + FramesInDuration(t - first_non_section_timestamp, default_spf);
+	}
+
 	TimecodesV1(FILE *vfrfile) {
 		char buf[100];
 
@@ -143,6 +213,20 @@ public:
 		return last_known_timestamp + (n - last_known_frame) * assumed_spf;
 	}
 
+	virtual int FrameNumberFromTimeStamp(double t) {
+		if (t <= 0.0 || timestamps.empty()) {
+			return 0;
+		}
+		if (t < last_known_timestamp) {
+			auto it = std::upper_bound(timestamps.cbegin(), timestamps.cend(), t);
+			return std::max((int)(it - timestamps.cbegin()) - 1, 0);
+		}
+		if (assumed_spf <= 0) {
+			return last_known_frame;
+		}
+		return last_known_frame + FramesInDuration(t - last_known_timestamp, assumed_spf);
+	}
+
 	TimecodesV2(FILE *vfrfile) {
 		char buf[50];
 
@@ -184,3 +268,65 @@ VFRTranslator *GetVFRTranslator(const char *vfrfile)
 	}
 	return res;
 }
+
+double BenchmarkVFRTranslator(int version, int nEntries, int nLookups)
+{
+	if ((version != 1 && version != 2) || nEntries < 2 || nLookups <= 0) {
+		return 0.0;
+	}
+
+	char dir[MAX_PATH], fn[MAX_PATH];
+	if (!GetTempPathA(MAX_PATH, dir) || !GetTempFileNameA(dir, "vfr", 0, fn)) {
+		return 0.0;
+	}
+
+	FILE* f;
+	if (fopen_s(&f, fn, "w")) {
+		DeleteFileA(fn);
+		return 0.0;
+	}
+
+	int nFrames;
+	if (version == 1) {
+		// sections of 10 frames at 29.97 and 59.94 fps, with 10 frames at the assumed rate between them
+		fputs("# timecode format v1\nAssume 23.976\n", f);
+		for (int i = 0; i < nEntries; i++) {
+			fprintf(f, "%d,%d,%s\n", i * 20, i * 20 + 9, i % 2 ? "59.94" : "29.97");
+		}
+		nFrames = nEntries * 20;
+	} else {
+		// telecined and progressive frames mixed
+		fputs("# timecode format v2\n", f);
+		double t = 0.0;
+		for (int i = 0; i < nEntries; i++) {
+			fprintf(f, "%.3f\n", t);
+			t += i % 5 == 4 ? 33.367 : 41.708;
+		}
+		nFrames = nEntries;
+	}
+	fclose(f);
+
+	std::unique_ptr<VFRTranslator> vfr(GetVFRTranslator(fn));
+	DeleteFileA(fn);
+	if (!vfr) {
+		return 0.0;
+	}
+
+	// random frames, the section hint of v1 only helps the consecutive ones
+	unsigned seed = 1;
+	int nMismatches = 0;
+
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < nLookups; i++) {
+		seed = seed * 1664525 + 1013904223;
+		const int n = (int)((seed >> 8) % nFrames);
+		if (vfr->FrameNumberFromTimeStamp(vfr->TimeStampFromFrameNumber(n)) != n) {
+			nMismatches++;
+		}
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	ASSERT(!nMismatches);
+
+	return seconds > 0.0 ? nLookups / seconds : 0.0;
+}
@@ -27,9 +27,17 @@
 class VFRTranslator
 {
 public:
+	virtual ~VFRTranslator() = default;
+
 	virtual double TimeStampFromFrameNumber(int n) PURE;
+	// Returns the frame shown at the given time
+	virtual int FrameNumberFromTimeStamp(double t) PURE;
 };
 
 VFRTranslator *GetVFRTranslator(const char *vfrfile);
 
+// Frame -> time -> frame round trips per second on random frames of a generated
+// v1 or v2 timecodes file with nEntries lines, 0 on failure
+double BenchmarkVFRTranslator(int version, int nEntries, int nLookups);
+
 #endif